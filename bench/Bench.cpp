@@ -0,0 +1,153 @@
+//benchmark driver. the system keeps its data in ./storage, so run it in an empty directory
+//  bench generate [options] > workload.txt    write a synthetic workload
+//  bench replay [output] < workload.txt        replay a workload and report latency. output keeps the text results
+//  bench run [options]                         generate and replay in process
+//  bench check [options]                       replay across a snapshot restore and serve a long refund queue, then
+//                                              scrub. fails if any record is corrupt or the queue is not served
+//options of the generator are listed in WorkloadConfig::parse
+
+#include <fstream>
+#include "WorkloadGenerator.hpp"
+#include "Replay.hpp"
+
+int usage() {
+  std::cerr << "usage: bench generate [options] | bench replay [output] | bench run [options] | "
+               "bench check [options]\n";
+  return 1;
+}
+
+//keep the last code and the last text, which is the report of scrub
+class CheckResponse : public NullResponse {
+public:
+  int last = 0;
+  std::string report;
+
+  void code(int x) override {
+    last = x;
+  }
+
+  void text(const std::string &s) override {
+    report = s;
+  }
+};
+
+class Check {
+  static constexpr int SEATS = 5000;
+  static constexpr int WAITING = 3000;
+
+  CheckResponse out;
+  Replay replay;
+  int stamp;
+
+  int run(const std::string &command) {
+    replay.run("[" + toStringInt(++stamp) + "] " + command);
+    return out.last;
+  }
+
+  //one refund fills the pending order of every user waiting on a sold out train. they must all be served, and the
+  //seats left over must still be sold. return false if not
+  bool refund() {
+    run("login -u user0 -p pw0"); //made first by every workload
+    for (int i = 0; i <= WAITING; i++) {
+      std::string user = "check" + toStringInt(i);
+      run("add_user -c user0 -u " + user + " -p pw -n 用户 -m " + user + "@mail.com -g 1");
+      run("login -u " + user + " -p pw");
+    }
+    run("add_train -i CHECK -n 2 -m " + toStringInt(SEATS) +
+        " -s CheckA|CheckB -p 1 -x 00:00 -t 60 -o _ -d 06-01|06-01 -y G");
+    run("release_train -i CHECK");
+    std::string buy = " -i CHECK -d 06-01 -f CheckA -t CheckB";
+    if (run("buy_ticket -u check0 -n " + toStringInt(SEATS) + buy) != SEATS) {
+      return false;
+    }
+    for (int i = 1; i <= WAITING; i++) {
+      run("buy_ticket -u check" + toStringInt(i) + " -n 1 -q true" + buy);
+    }
+    return run("refund_ticket -u check0 -n 1") == 0 &&
+           run("buy_ticket -u check0 -n " + toStringInt(SEATS - WAITING + 1) + buy) == -1 &&
+           run("buy_ticket -u check0 -n " + toStringInt(SEATS - WAITING) + buy) == SEATS - WAITING;
+  }
+
+public:
+  explicit Check(int stamp) : replay(out), stamp(stamp) {}
+
+  //a snapshot is taken after the first third of the workload and restored after the second, so that the last third
+  //writes over the restored stores. then a refund serves a long queue. every record must pass scrub after
+  int run(const list<std::string> &lines) {
+    size_t third = lines.size() / 3;
+    for (size_t i = 0; i < lines.size(); i++) {
+      if (i == third) {
+        run("create_snapshot -i check");
+      } else if (i == 2 * third) {
+        run("restore_snapshot -i check");
+      }
+      replay.run(lines[i]);
+    }
+    bool served = refund();
+    run("scrub");
+    run("delete_snapshot -i check");
+    std::cout << out.report << '\n';
+    if (!served) {
+      std::cout << "refund failed\n";
+    }
+    return served && out.report == "corrupt 0" ? 0 : 1;
+  }
+};
+
+int main(int argc, char *argv[]) {
+  std::ios::sync_with_stdio(false);
+  if (argc < 2) {
+    return usage();
+  }
+  std::string mode = argv[1];
+  if (mode == "generate" || mode == "run" || mode == "check") {
+    WorkloadConfig config;
+    if (!config.parse(argc, argv, 2)) {
+      return usage();
+    }
+    WorkloadGenerator generator(config);
+    if (mode == "generate") {
+      generator.run([](const std::string &line) {
+        std::cout << line << '\n';
+      });
+      return 0;
+    }
+    list<std::string> lines;
+    generator.run([&lines](const std::string &line) {
+      lines.push_back(line);
+    });
+    if (mode == "check") {
+      Commands::init();
+      return Check((int) lines.size()).run(lines);
+    }
+    NullResponse out;
+    Commands::init();
+    Replay replay(out);
+    for (size_t i = 0; i < lines.size(); i++) {
+      replay.run(lines[i]);
+    }
+    replay.report(std::cout);
+    return 0;
+  }
+  if (mode == "replay") {
+    list<std::string> lines;
+    std::string line;
+    while (getline(std::cin, line)) {
+      lines.push_back(line);
+    }
+    std::ofstream file;
+    NullResponse discard;
+    TextResponse text(file);
+    if (argc > 2) {
+      file.open(argv[2]);
+    }
+    Commands::init();
+    Replay replay(argc > 2 ? (Response &) text : discard);
+    for (size_t i = 0; i < lines.size(); i++) {
+      replay.run(lines[i]);
+    }
+    replay.report(std::cout);
+    return 0;
+  }
+  return usage();
+}
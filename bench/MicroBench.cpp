@@ -0,0 +1,407 @@
+//microbenchmarks of the persistent trees and hash maps, independent of the command layer
+//  microbench [count] [seed] [threads]
+//each case builds a tree in ./storage/mb_*, so run it in an empty directory
+//the concurrent cases also check that readers never miss a record which stays in the tree
+//reported bytes are file traffic of the tree's stores, counted by StorageStats
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include "../src/Train.hpp"
+#include "../src/persistent_data_structure/PersistentHashMap.hpp"
+#include "../src/persistent_data_structure/PersistentMultiMap.hpp"
+#include "../src/persistent_data_structure/PersistentSet.hpp"
+
+//record shaped like Account
+struct UserRecord {
+  String20 key;
+  int data[21];
+  using INDEX = String20;
+
+  const INDEX &index() const {
+    return key;
+  }
+};
+
+//record keyed like the seat index, trainID and train number
+struct TrainDayRecord {
+  pair<String20, int> key;
+  int data[4];
+  using INDEX = pair<String20, int>;
+
+  const INDEX &index() const {
+    return key;
+  }
+};
+
+//record shaped like Order, pushed to the front of its user
+struct OrderRecord {
+  String20 key;
+  int data[36];
+  using INDEX = String20;
+
+  const INDEX &index() const {
+    return key;
+  }
+};
+
+namespace MicroBench {
+  constexpr int SCAN_LENGTH = 100;
+
+  int count = 100000;
+  unsigned long long seed = 1;
+
+  unsigned long long next() { //splitmix64
+    unsigned long long z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  list<int> permutation(int n, bool shuffled) {
+    list<int> ret;
+    for (int i = 0; i < n; i++) {
+      ret.push_back(i);
+    }
+    for (int i = n - 1; shuffled && i > 0; i--) {
+      std::swap(ret[i], ret[next() % (i + 1)]);
+    }
+    return ret;
+  }
+
+  //zero padded so that the key order is the numeric order
+  String20 name(int i) {
+    return "u" + toStringInt(i, 9);
+  }
+
+  void key(int i, String20 &k) {
+    k = name(i);
+  }
+
+  void key(int i, pair<String20, int> &k) {
+    k = {name(i / 92), i % 92};
+  }
+
+  void key(int i, Station &k) {
+    k = {"s" + toStringInt(i / 30, 9), i, i % 30};
+  }
+
+  unsigned long long bytes(bool written) {
+    unsigned long long ret = 0;
+    for (size_t i = 0; i < Stats::stores.size(); i++) {
+      if (Stats::stores[i]->name.starts_with("mb_")) {
+        ret += written ? Stats::stores[i]->bytesWritten : Stats::stores[i]->bytesRead;
+      }
+    }
+    return ret;
+  }
+
+  void header() {
+    std::cout << std::left << std::setw(54) << "case" << std::right << std::setw(10) << "ops" << std::setw(14)
+              << "ops/s" << std::setw(14) << "read B/op" << std::setw(14) << "write B/op" << '\n';
+  }
+
+  //time body, which performs ops operations. inner nodes stay in memory until the tree is closed,
+  //so the bytes are those of the leaves
+  template<typename F>
+  void measure(const std::string &tree, const std::string &name, int ops, F body) {
+    unsigned long long read = bytes(false), written = bytes(true);
+    auto start = std::chrono::steady_clock::now();
+    body();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << std::left << std::setw(54) << tree + " " + name << std::right << std::setw(10) << ops
+              << std::setw(14) << (long long) (seconds > 0 ? ops / seconds : 0) << std::fixed << std::setprecision(1)
+              << std::setw(14) << (double) (bytes(false) - read) / ops << std::setw(14)
+              << (double) (bytes(true) - written) / ops << std::endl;
+  }
+
+  void clear() {
+    std::filesystem::create_directory("storage");
+    for (const auto &entry: std::filesystem::directory_iterator("storage")) {
+      if (entry.path().filename().string().starts_with("mb_")) {
+        std::filesystem::remove(entry.path());
+      }
+    }
+  }
+
+  template<typename Record, int CACHE_SIZE>
+  void map(const std::string &tree, bool shuffled) {
+    using Map = PersistentMap<Record, CACHE_SIZE>;
+    clear();
+    Map *map = new Map("mb_map");
+    list<int> order = permutation(count, shuffled);
+    list<int> lookup = permutation(count, true);
+    std::string tag = shuffled ? "random " : "sequential ";
+    measure(tree, tag + "insert", count, [&] {
+      Record record{};
+      for (int i = 0; i < count; i++) {
+        key(order[i], record.key);
+        map->insert(record);
+        map->checkCache();
+      }
+    });
+    measure(tree, tag + "get", count, [&] {
+      typename Record::INDEX k;
+      for (int i = 0; i < count; i++) {
+        key(lookup[i], k);
+        if (!map->get(k).present) {
+          throw;
+        }
+        map->checkCache();
+      }
+    });
+    int scans = count / SCAN_LENGTH;
+    measure(tree, tag + "scan x" + std::to_string(SCAN_LENGTH), scans * SCAN_LENGTH, [&] {
+      typename Record::INDEX k;
+      for (int i = 0; i < scans; i++) {
+        key(lookup[i] % (count - SCAN_LENGTH), k);
+        auto it = map->get(k).value;
+        for (int j = 1; j < SCAN_LENGTH; j++) {
+          ++it;
+        }
+        map->checkCache();
+      }
+    });
+    measure(tree, tag + "erase", count, [&] {
+      typename Record::INDEX k;
+      for (int i = 0; i < count; i++) {
+        key(order[i], k);
+        map->erase(k);
+        map->checkCache();
+      }
+    });
+    delete map;
+  }
+
+  //the point operations of map, on the hash map which replaces it for maps without scans
+  template<typename Record, int CACHE_SIZE>
+  void hashMap(const std::string &tree, bool shuffled) {
+    using Map = PersistentHashMap<Record, CACHE_SIZE>;
+    clear();
+    Map *map = new Map("mb_hash");
+    list<int> order = permutation(count, shuffled);
+    list<int> lookup = permutation(count, true);
+    std::string tag = shuffled ? "random " : "sequential ";
+    measure(tree, tag + "insert", count, [&] {
+      Record record{};
+      for (int i = 0; i < count; i++) {
+        key(order[i], record.key);
+        map->insert(record);
+        map->checkCache();
+      }
+    });
+    measure(tree, tag + "get", count, [&] {
+      typename Record::INDEX k;
+      for (int i = 0; i < count; i++) {
+        key(lookup[i], k);
+        if (!map->get(k).present) {
+          throw;
+        }
+        map->checkCache();
+      }
+    });
+    measure(tree, tag + "erase", count, [&] {
+      typename Record::INDEX k;
+      for (int i = 0; i < count; i++) {
+        key(order[i], k);
+        map->erase(k);
+        map->checkCache();
+      }
+    });
+    delete map;
+  }
+
+  template<int CACHE_SIZE>
+  void set(const std::string &tree, bool shuffled) {
+    using Set = PersistentSet<Station, CACHE_SIZE>;
+    clear();
+    Set *set = new Set("mb_set");
+    list<int> order = permutation(count, shuffled);
+    std::string tag = shuffled ? "random " : "sequential ";
+    measure(tree, tag + "insert", count, [&] {
+      Station station;
+      for (int i = 0; i < count; i++) {
+        key(order[i], station);
+        set->insert(station);
+        set->checkCache();
+      }
+    });
+    //the same access as queryTicket, all stops of a station
+    int scans = count / 30;
+    measure(tree, tag + "station scan x30", scans * 30, [&] {
+      Station station;
+      for (int i = 0; i < scans; i++) {
+        key(order[i] % scans * 30, station);
+        auto it = set->find(station);
+        for (int j = 1; j < 30; j++) {
+          ++it;
+        }
+        set->checkCache();
+      }
+    });
+    measure(tree, tag + "erase", count, [&] {
+      Station station;
+      for (int i = 0; i < count; i++) {
+        key(order[i], station);
+        set->erase(station);
+        set->checkCache();
+      }
+    });
+    delete set;
+  }
+
+  //orders go to the front of a user picked with skew, like buy_ticket
+  //queued requests go to the back of a train day, like the pending queue
+  template<int CACHE_SIZE>
+  void multiMap(const std::string &tree) {
+    using OrderMap = PersistentMultiMap<OrderRecord, CACHE_SIZE>;
+    using QueueMap = PersistentMultiMap<TrainDayRecord, CACHE_SIZE>;
+    clear();
+    OrderMap *orders = new OrderMap("mb_order");
+    QueueMap *queue = new QueueMap("mb_queue");
+    int users = count / 20 + 1;
+    list<int> owner, ticks;
+    for (int i = 0; i < count; i++) {
+      int k = next() % users;
+      owner.push_back(next() % 2 ? k : k % (users / 10 + 1)); //half of the orders belong to a tenth of users
+    }
+    measure(tree, "pushFront", count, [&] {
+      OrderRecord record{};
+      for (int i = 0; i < count; i++) {
+        key(owner[i], record.key);
+        ticks.push_back(orders->pushFront(record));
+        orders->checkCache();
+      }
+    });
+    measure(tree, "user scan", users, [&] {
+      String20 userID;
+      for (int i = 0; i < users; i++) {
+        key(i, userID);
+        for (auto it = orders->find(userID); !it.end() && it->val.key == userID; ++it) {}
+        orders->checkCache();
+      }
+    });
+    list<int> erased = permutation(count, true);
+    measure(tree, "erase", count, [&] {
+      String20 userID;
+      for (int i = 0; i < count; i++) {
+        key(owner[erased[i]], userID);
+        orders->erase(userID, ticks[erased[i]]);
+        orders->checkCache();
+      }
+    });
+    delete orders;
+    list<int> days = permutation(count, true);
+    measure(tree, "pushBack", count, [&] {
+      TrainDayRecord record{};
+      for (int i = 0; i < count; i++) {
+        key(days[i] % (count / 10 + 1), record.key);
+        queue->pushBack(record);
+        queue->checkCache();
+      }
+    });
+    delete queue;
+  }
+
+  int number(const String20 &k) {
+    return std::stoi(k.toString().substr(1));
+  }
+
+  //readers look up and scan even keys, which stay in the tree, while one writer inserts and erases odd keys
+  void concurrent(int threads) {
+    using Map = PersistentMap<UserRecord>;
+    clear();
+    Map *map = new Map("mb_map");
+    UserRecord record{};
+    for (int i = 0; i < count; i++) {
+      key(2 * i, record.key);
+      map->insert(record);
+    }
+    map->checkCache();
+    std::atomic<bool> done{false};
+    std::atomic<long long> lost{0};
+    long long writes = 0;
+    int reads = count / threads * threads;
+    measure("map<String20> concurrent", std::to_string(threads) + " readers + writer", reads, [&] {
+      std::thread writer([&] {
+        UserRecord odd{};
+        int window = std::min(256, count / 2);
+        for (int i = 0; !done; i++, writes++) {
+          key(2 * (i % count) + 1, odd.key);
+          map->insert(odd);
+          if (i >= window) {
+            key(2 * ((i - window) % count) + 1, odd.key);
+            map->erase(odd.key);
+          }
+        }
+      });
+      std::thread readers[64];
+      for (int t = 0; t < threads; t++) {
+        readers[t] = std::thread([&, t] {
+          unsigned long long state = seed + t;
+          for (int j = 0; j < count / threads; j++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            int i = (int) (state >> 33) % count;
+            String20 k;
+            key(2 * i, k);
+            UserRecord result;
+            if (!map->read(k, result) || result.key != k) {
+              lost++;
+            }
+            if (j % 64 == 0) { //consecutive even keys must all be visited
+              int expect = 2 * i, visited = 0;
+              map->scan(k, [&](const UserRecord &r) {
+                int x = number(r.key);
+                if (x % 2 == 0) {
+                  lost += x != expect;
+                  expect = x + 2;
+                }
+                return ++visited < SCAN_LENGTH;
+              });
+            }
+          }
+        });
+      }
+      for (int t = 0; t < threads; t++) {
+        readers[t].join();
+      }
+      done = true;
+      writer.join();
+    });
+    std::cout << "  writer ops " << writes << ", inconsistent reads " << lost << std::endl;
+    map->checkCache();
+    delete map;
+  }
+
+  template<int CACHE_SIZE>
+  void run(const std::string &cache) {
+    for (bool shuffled: {false, true}) {
+      map<UserRecord, CACHE_SIZE>("map<String20> cache=" + cache, shuffled);
+      map<TrainDayRecord, CACHE_SIZE>("map<pair<String20,int>> cache=" + cache, shuffled);
+      hashMap<UserRecord, CACHE_SIZE>("hash<String20> cache=" + cache, shuffled);
+      set<CACHE_SIZE>("set<Station> cache=" + cache, shuffled);
+    }
+    multiMap<CACHE_SIZE>("multimap cache=" + cache);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) {
+    MicroBench::count = std::max(std::stoi(argv[1]), 2 * MicroBench::SCAN_LENGTH);
+  }
+  if (argc > 2) {
+    MicroBench::seed = std::stoull(argv[2]);
+  }
+  MicroBench::header();
+  MicroBench::run<0>("0");
+  MicroBench::run<1 << 20>("1M");
+  MicroBench::run<1 << 24>("16M");
+  int threads = argc > 3 ? std::min(64, std::stoi(argv[3])) : std::max(2, (int) std::thread::hardware_concurrency());
+  for (int t = 1; t <= threads; t *= 2) {
+    MicroBench::concurrent(t);
+  }
+  MicroBench::clear();
+  return 0;
+}
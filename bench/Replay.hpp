@@ -0,0 +1,125 @@
+#ifndef TICKETSYSTEM2024_REPLAY_HPP
+#define TICKETSYSTEM2024_REPLAY_HPP
+
+#include <chrono>
+#include "../src/Command.hpp"
+#include "../src/protocol/TextProtocol.hpp"
+#include "../src/util/Histogram.hpp"
+
+//discard results. only count records so that nothing is optimized away
+class NullResponse : public Response {
+public:
+  long long records = 0;
+
+  void begin(const Command &command) override {}
+
+  void end() override {}
+
+  void code(int x) override {
+    records++;
+  }
+
+  void queued() override {
+    records++;
+  }
+
+  void bye() override {
+    records++;
+  }
+
+  void count(int n) override {
+    records++;
+  }
+
+  void account(const Account &account) override {
+    records++;
+  }
+
+  void train(const String20 &trainID, char type) override {
+    records++;
+  }
+
+  void stop(const String40 &station, const Chrono &arrival, const Chrono &departure, int price, int seat) override {
+    records++;
+  }
+
+  void line(const Line &line) override {
+    records++;
+  }
+
+  void order(const Order &order) override {
+    records++;
+  }
+
+  void text(const std::string &s) override {
+    records++;
+  }
+};
+
+//run commands in process and collect per-command latency, including the cache write-back after each command
+class Replay {
+  struct Entry {
+    std::string name;
+    Histogram latency;
+  };
+
+  list<Entry *> entries;
+  Histogram all;
+  Response &out;
+  double seconds = 0;
+
+  Histogram &of(const std::string &name) {
+    for (Entry *entry: entries) {
+      if (entry->name == name) {
+        return entry->latency;
+      }
+    }
+    entries.push_back(new Entry{name, {}});
+    return entries.back()->latency;
+  }
+
+  static void print(std::ostream &os, const std::string &name, const Histogram &h) {
+    auto us = [](unsigned long long ns) {
+      return std::to_string(ns / 1000) + "." + toStringInt(ns % 1000 / 10, 2);
+    };
+    os << name << std::string(name.length() < 16 ? 16 - name.length() : 1, ' ')
+       << h.count() << '\t' << us((unsigned long long) h.mean()) << '\t' << us(h.percentile(0.5)) << '\t'
+       << us(h.percentile(0.99)) << '\t' << us(h.percentile(0.999)) << '\t' << us(h.max()) << '\n';
+  }
+
+public:
+  explicit Replay(Response &out) : out(out) {}
+
+  ~Replay() {
+    for (Entry *entry: entries) {
+      delete entry;
+    }
+  }
+
+  void run(const std::string &line) {
+    Command command(line);
+    auto start = std::chrono::steady_clock::now();
+    Commands::run(command, out); //includes the cache write-back
+    auto stop = std::chrono::steady_clock::now();
+    unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    of(command.name).record(ns);
+    all.record(ns);
+    seconds += ns / 1e9;
+    if (!Commands::running) { //the system restarts after exit, and everyone is logged out
+      Commands::running = true;
+      Accounts::currentAccounts.clear();
+    }
+  }
+
+  void report(std::ostream &os) {
+    os << "commands " << all.count() << ", " << seconds << " s, " << (seconds > 0 ? all.count() / seconds : 0)
+       << " commands/s\n";
+    os << "command         count\tmean(us)\tp50(us)\tp99(us)\tp999(us)\tmax(us)\n";
+    for (Entry *entry: entries) {
+      print(os, entry->name, entry->latency);
+    }
+    print(os, "all", all);
+  }
+};
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef TICKETSYSTEM2024_WORKLOAD_GENERATOR_HPP
+#define TICKETSYSTEM2024_WORKLOAD_GENERATOR_HPP
+
+#include "../src/util/Util.hpp"
+
+struct WorkloadConfig {
+  int commands = 100000; //commands after the initial setup
+  int stations = 500; //size of the station pool
+  int minLength = 2; //stations per train. Seats holds at most 30
+  int maxLength = 30;
+  int minSale = 1; //days in a sale range. sale dates are within 06-01 to 08-31
+  int maxSale = 92;
+  int minSeat = 100;
+  int maxSeat = 2000;
+  int maxBuy = 50; //tickets per buy_ticket
+  int initialUsers = 100;
+  int initialTrains = 200;
+  double userSkew = 0.8; //the k-th user is picked with probability ~ k^-userSkew. 0 is uniform, must be below 1
+  double stationSkew = 0.5; //the same for stations when laying out trains
+  unsigned long long seed = 1;
+
+  //parse "--key value" pairs. return false on unknown keys
+  bool parse(int argc, char *argv[], int first) {
+    for (int i = first; i + 1 < argc; i += 2) {
+      std::string key = argv[i];
+      std::string value = argv[i + 1];
+      if (key == "--commands") {
+        commands = parseInt(value);
+      } else if (key == "--stations") {
+        stations = parseInt(value);
+      } else if (key == "--min-length") {
+        minLength = parseInt(value);
+      } else if (key == "--max-length") {
+        maxLength = parseInt(value);
+      } else if (key == "--min-sale") {
+        minSale = parseInt(value);
+      } else if (key == "--max-sale") {
+        maxSale = parseInt(value);
+      } else if (key == "--min-seat") {
+        minSeat = parseInt(value);
+      } else if (key == "--max-seat") {
+        maxSeat = parseInt(value);
+      } else if (key == "--max-buy") {
+        maxBuy = parseInt(value);
+      } else if (key == "--users") {
+        initialUsers = parseInt(value);
+      } else if (key == "--trains") {
+        initialTrains = parseInt(value);
+      } else if (key == "--user-skew") {
+        userSkew = std::stod(value);
+      } else if (key == "--station-skew") {
+        stationSkew = std::stod(value);
+      } else if (key == "--seed") {
+        seed = std::stoull(value);
+      } else {
+        return false;
+      }
+    }
+    if (minLength < 2) {
+      minLength = 2;
+    }
+    if (maxLength > 30) {
+      maxLength = 30;
+    }
+    if (stations < maxLength) {
+      stations = maxLength;
+    }
+    return true;
+  }
+};
+
+//synthetic workload following the frequency classes of management_system.md:
+//[SF] ~1000000, [F] ~100000, [N] ~10000, [R] ~100 occurrences in the largest test
+//the generator tracks users, sessions and trains so that most commands are meaningful
+class WorkloadGenerator {
+  enum Kind {
+    ADD_USER, LOGIN, LOGOUT, QUERY_PROFILE, MODIFY_PROFILE, ADD_TRAIN, DELETE_TRAIN, RELEASE_TRAIN, QUERY_TRAIN,
+    QUERY_TICKET, QUERY_TRANSFER, BUY_TICKET, QUERY_ORDER, REFUND_TICKET, EXIT, KIND_COUNT
+  };
+
+  static constexpr int SF = 1000000;
+  static constexpr int F = 100000;
+  static constexpr int N = 10000;
+  static constexpr int R = 100;
+  //clean is [R] too, but it is not supported by the system
+  static constexpr int weights[KIND_COUNT] = {N, F, F, SF, F, N, N, N, N, SF, N, SF, F, N, R};
+
+  struct User {
+    std::string name;
+    int privilege;
+    int loggedPos; //position in logged, -1 if not logged in
+  };
+
+  struct Train {
+    std::string id;
+    list<int> stations;
+    int startDate;
+    int endDate;
+    int state; //0 for unreleased, 1 for released, 2 for deleted
+  };
+
+  WorkloadConfig config;
+  unsigned long long state;
+  int timestamp = 0;
+  list<User> users;
+  list<int> logged;
+  list<Train> trains;
+  list<int> unreleased;
+  list<int> released;
+
+  unsigned long long next() { //splitmix64
+    unsigned long long z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  int uniform(int l, int r) { //in [l, r]
+    return l + (int) (next() % (unsigned long long) (r - l + 1));
+  }
+
+  double real() { //in [0, 1)
+    return (next() >> 11) * 0x1.0p-53;
+  }
+
+  int skewed(int n, double skew) { //in [0, n). small values are more likely
+    int ret = (int) (n * pow(real(), 1 / (1 - skew)));
+    return ret < n ? ret : n - 1;
+  }
+
+  static std::string date(int x) {
+    return toStringDate(x);
+  }
+
+  std::string station(int x) const {
+    return "S" + toStringInt(x, 4);
+  }
+
+  std::string head() {
+    return "[" + toStringInt(++timestamp) + "] ";
+  }
+
+  int pickUser() {
+    return skewed(users.size(), config.userSkew);
+  }
+
+  int pickLogged() { //-1 if nobody is logged in
+    return logged.empty() ? -1 : logged[skewed(logged.size(), config.userSkew)];
+  }
+
+  void setLogged(int user, bool on) {
+    User &u = users[user];
+    if (on && u.loggedPos < 0) {
+      u.loggedPos = logged.size();
+      logged.push_back(user);
+    } else if (!on && u.loggedPos >= 0) {
+      int last = logged.back();
+      logged[u.loggedPos] = last;
+      users[last].loggedPos = u.loggedPos;
+      logged.pop_back();
+      u.loggedPos = -1;
+    }
+  }
+
+  static void removeAt(list<int> &v, int pos) {
+    v[pos] = v.back();
+    v.pop_back();
+  }
+
+  int pickDate(const Train &train) { //a departure date from the start station within the sale range
+    return uniform(train.startDate, train.endDate);
+  }
+
+  std::string addUser() {
+    int current = pickLogged();
+    int privilege = current < 0 ? 10 : uniform(0, users[current].privilege > 0 ? users[current].privilege - 1 : 0);
+    std::string name = "user" + toStringInt(users.size());
+    std::string ret = head() + "add_user -c " + (current < 0 ? name : users[current].name) + " -u " + name +
+                      " -p pw" + toStringInt(users.size()) + " -n 用户 -m " + name + "@mail.com -g " +
+                      toStringInt(privilege);
+    if (users.empty() || (current >= 0 && privilege < users[current].privilege)) {
+      users.push_back({name, users.empty() ? 10 : privilege, -1});
+    }
+    return ret;
+  }
+
+  std::string login(int user) {
+    setLogged(user, true);
+    return head() + "login -u " + users[user].name + " -p pw" + toStringInt(user);
+  }
+
+  std::string addTrain() {
+    Train train;
+    train.id = "T" + toStringInt(trains.size(), 6);
+    int length = uniform(config.minLength, config.maxLength);
+    std::string s, p, t, o;
+    while (train.stations.size() < length) {
+      int x = skewed(config.stations, config.stationSkew);
+      bool duplicated = false;
+      for (int y: train.stations) {
+        duplicated |= x == y;
+      }
+      if (!duplicated) {
+        train.stations.push_back(x);
+        s += (s.empty() ? "" : "|") + station(x);
+      }
+    }
+    int maxTravel = 4000 / (length - 1) - 20; //the whole trip takes no more than 72 hours
+    for (int i = 0; i < length - 1; i++) {
+      p += (i ? "|" : "") + toStringInt(uniform(1, 1000));
+      t += (i ? "|" : "") + toStringInt(uniform(10, maxTravel > 10 ? maxTravel : 10));
+      if (i < length - 2) {
+        o += (i ? "|" : "") + toStringInt(uniform(1, 20));
+      }
+    }
+    int sale = uniform(config.minSale, config.maxSale);
+    train.startDate = uniform(0, 92 - sale);
+    train.endDate = train.startDate + sale - 1;
+    train.state = 0;
+    std::string ret = head() + "add_train -i " + train.id + " -n " + toStringInt(length) + " -m " +
+                      toStringInt(uniform(config.minSeat, config.maxSeat)) + " -s " + s + " -p " + p + " -x " +
+                      toStringTime(uniform(0, 1439)) + " -t " + t + " -o " + (o.empty() ? "_" : o) + " -d " +
+                      date(train.startDate) + "|" + date(train.endDate) + " -y " + (char) ('A' + uniform(0, 25));
+    unreleased.push_back(trains.size());
+    trains.push_back(train);
+    return ret;
+  }
+
+  std::string releaseTrain() {
+    int pos = uniform(0, unreleased.size() - 1);
+    int x = unreleased[pos];
+    removeAt(unreleased, pos);
+    trains[x].state = 1;
+    released.push_back(x);
+    return head() + "release_train -i " + trains[x].id;
+  }
+
+  std::string deleteTrain() {
+    int pos = uniform(0, unreleased.size() - 1);
+    int x = unreleased[pos];
+    removeAt(unreleased, pos);
+    trains[x].state = 2;
+    return head() + "delete_train -i " + trains[x].id;
+  }
+
+  std::string queryTicket(bool transfer) {
+    std::string from, to;
+    int day;
+    if (!transfer && !released.empty() && uniform(0, 9)) { //mostly routes served by some train
+      const Train &train = trains[released[uniform(0, released.size() - 1)]];
+      int i = uniform(0, train.stations.size() - 2);
+      int j = uniform(i + 1, train.stations.size() - 1);
+      from = station(train.stations[i]);
+      to = station(train.stations[j]);
+      day = pickDate(train);
+    } else {
+      int i = skewed(config.stations, config.stationSkew);
+      int j = skewed(config.stations, config.stationSkew);
+      if (i == j) {
+        j = (j + 1) % config.stations;
+      }
+      from = station(i);
+      to = station(j);
+      day = uniform(0, 91);
+    }
+    return head() + (transfer ? "query_transfer -s " : "query_ticket -s ") + from + " -t " + to + " -d " +
+           date(day) + " -p " + (uniform(0, 1) ? "time" : "cost");
+  }
+
+  std::string buyTicket(int user) {
+    const Train &train = trains[released[uniform(0, released.size() - 1)]];
+    int i = uniform(0, train.stations.size() - 2);
+    int j = uniform(i + 1, train.stations.size() - 1);
+    //the date is the departure from the start station, which is a valid approximation of the date at station i
+    return head() + "buy_ticket -u " + users[user].name + " -i " + train.id + " -d " + date(pickDate(train)) +
+           " -n " + toStringInt(uniform(1, config.maxBuy)) + " -f " + station(train.stations[i]) + " -t " +
+           station(train.stations[j]) + " -q " + (uniform(0, 1) ? "true" : "false");
+  }
+
+  std::string generate(Kind kind) { //return empty string if kind is not applicable now
+    int user = pickLogged();
+    switch (kind) {
+      case ADD_USER:
+        return addUser();
+      case LOGIN:
+        return login(pickUser());
+      case LOGOUT:
+        if (user < 0) {
+          return "";
+        }
+        setLogged(user, false);
+        return head() + "logout -u " + users[user].name;
+      case QUERY_PROFILE:
+        return user < 0 ? "" : head() + "query_profile -c " + users[user].name + " -u " + users[pickUser()].name;
+      case MODIFY_PROFILE:
+        return user < 0 ? "" : head() + "modify_profile -c " + users[user].name + " -u " + users[user].name +
+                               " -m " + users[user].name + toStringInt(timestamp) + "@mail.com";
+      case ADD_TRAIN:
+        return addTrain();
+      case DELETE_TRAIN:
+        return unreleased.empty() ? "" : deleteTrain();
+      case RELEASE_TRAIN:
+        return unreleased.empty() ? "" : releaseTrain();
+      case QUERY_TRAIN: {
+        if (trains.empty()) {
+          return "";
+        }
+        const Train &train = trains[uniform(0, trains.size() - 1)];
+        return head() + "query_train -i " + train.id + " -d " + date(pickDate(train));
+      }
+      case QUERY_TICKET:
+        return queryTicket(false);
+      case QUERY_TRANSFER:
+        return queryTicket(true);
+      case BUY_TICKET:
+        return user < 0 || released.empty() ? "" : buyTicket(user);
+      case QUERY_ORDER:
+        return user < 0 ? "" : head() + "query_order -u " + users[user].name;
+      case REFUND_TICKET:
+        return user < 0 ? "" : head() + "refund_ticket -u " + users[user].name + " -n " + toStringInt(uniform(1, 3));
+      case EXIT:
+        while (!logged.empty()) { //exit logs everyone out
+          setLogged(logged.back(), false);
+        }
+        return head() + "exit";
+      default:
+        return "";
+    }
+  }
+
+  Kind pickKind() {
+    static constexpr long long total = [] {
+      long long ret = 0;
+      for (int w: weights) {
+        ret += w;
+      }
+      return ret;
+    }();
+    long long x = (long long) (next() % total);
+    for (int i = 0; i < KIND_COUNT; i++) {
+      if (x < weights[i]) {
+        return (Kind) i;
+      }
+      x -= weights[i];
+    }
+    return QUERY_PROFILE;
+  }
+
+public:
+  explicit WorkloadGenerator(const WorkloadConfig &config) : config(config), state(config.seed) {}
+
+  //call consumer on each line of the workload, ending with exit
+  template<typename Consumer>
+  void run(Consumer consumer) {
+    consumer(addUser());
+    consumer(login(0));
+    for (int i = 1; i < config.initialUsers; i++) {
+      consumer(addUser());
+      if (uniform(0, 1)) {
+        consumer(login(users.size() - 1));
+      }
+    }
+    for (int i = 0; i < config.initialTrains; i++) {
+      consumer(addTrain());
+      if (uniform(0, 3)) {
+        consumer(releaseTrain());
+      }
+    }
+    for (int i = 0; i < config.commands; i++) {
+      std::string line;
+      while (line.empty()) {
+        line = generate(pickKind());
+      }
+      consumer(line);
+    }
+    consumer(generate(EXIT));
+  }
+};
+
+#endif
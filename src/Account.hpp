@@ -6,7 +6,8 @@
 #define TICKETSYSTEM2024_ACCOUNT_HPP
 
 #include "util/Util.hpp"
-#include "persistent_data_structure/PersistentMap.hpp"
+#include "data_structure/hash_table.hpp"
+#include "persistent_data_structure/PersistentHashMap.hpp"
 
 struct Account {
   String20 userID;
@@ -31,7 +32,7 @@ struct Account {
 };
 
 namespace AccountStorage {
-  PersistentMap<Account> accountMap("accounts");
+  PersistentHashMap<Account> accountMap("accounts");
 
   bool empty() {
     return accountMap.empty();
@@ -56,11 +57,47 @@ namespace AccountStorage {
 }
 
 namespace Accounts {
-  map<String20, Account> currentAccounts;
+  //what the commands need of a logged user, as it was when they logged in
+  struct Session {
+    String20 userID;
+    int privilege;
+    using INDEX = String20;
+
+    const INDEX &index() const {
+      return userID;
+    }
+  };
+
+  hash_table<Session> currentAccounts;
+
+  //logged users a snapshot reader may ask about, copied when it is dispatched, since the writer thread goes on
+  //changing currentAccounts meanwhile
+  struct Sessions {
+    static constexpr int MAX_COUNT = 2;
+    Session accounts[MAX_COUNT];
+    int count = 0;
+
+    void capture(const String20 &index) {
+      Session *session = currentAccounts.find(index);
+      if (session && count < MAX_COUNT) {
+        accounts[count++] = *session;
+      }
+    }
+  };
 
-  Optional<Account*> getLogged(const String20 &index) {
-    auto it = currentAccounts.find(index);
-    return it == currentAccounts.end() ? Optional<Account*>() : Optional<Account*>(&it->second);
+  thread_local Sessions *sessions = nullptr; //set on the threads of snapshot readers
+
+  Optional<Session*> getLogged(const String20 &index) {
+    if (sessions) {
+      for (int i = 0; i < sessions->count; i++) {
+        if (sessions->accounts[i].userID == index) {
+          return {&sessions->accounts[i]};
+        }
+      }
+      return {};
+    }
+    Session *session = currentAccounts.find(index);
+    return session ? Optional<Session*>(session) : Optional<Session*>();
   }
 
   bool login(const String20 &index, const String30 &password) {
@@ -68,16 +105,11 @@ namespace Accounts {
     if (!account.present || account.value->password != password) {
       return false;
     }
-    return currentAccounts.insert({index, *account.value}).second;
+    return currentAccounts.insert({index, account.value->privilege});
   }
 
   bool logout(const String20 &index) {
-    auto it = currentAccounts.find(index);
-    if (it == currentAccounts.end()) {
-      return false;
-    }
-    currentAccounts.erase(it);
-    return true;
+    return currentAccounts.erase(index);
   }
 }
 #endif
@@ -8,11 +8,21 @@
 #include "Account.hpp"
 #include "Train.hpp"
 #include "Order.hpp"
+#include "file_storage/NamedSnapshots.hpp"
+#include "protocol/Response.hpp"
+#include "util/Histogram.hpp"
+#include "util/Stats.hpp"
+#include <chrono>
 
 struct Command {
   std::string timestamp;
+  int stamp = 0; //numeric timestamp used by the binary protocol
   std::string name;
   std::string params[26];
+  int values[26]; //typed parameters decoded by the binary protocol
+  unsigned typed = 0; //bit i is set if values[i] holds the parameter
+
+  Command() = default;
 
   explicit Command(const std::string &s) {
     int status = 0;
@@ -36,69 +46,106 @@ struct Command {
     }
   }
 
+  bool isTyped(char c) const {
+    return typed >> (c - 'a') & 1;
+  }
+
+  void setValue(char c, int x) {
+    values[c - 'a'] = x;
+    typed |= 1u << (c - 'a');
+  }
+
+  bool hasParam(char c) const {
+    return isTyped(c) || !params[c - 'a'].empty();
+  }
+
   const std::string &getParam(char c) const {
     return params[c - 'a'];
   }
 
   int getIntParam(char c) const {
-    return parseInt(params[c - 'a']);
+    return isTyped(c) ? values[c - 'a'] : parseInt(params[c - 'a']);
+  }
+
+  int getDateParam(char c) const {
+    return isTyped(c) ? values[c - 'a'] : parseDate(params[c - 'a']);
+  }
+
+  bool getFlagParam(char c, const char *on) const { //on is the text value meaning true
+    return isTyped(c) ? values[c - 'a'] != 0 : params[c - 'a'] == on;
+  }
+
+  String40 getStationParam(char c) const { //typed stations are interned ids
+    return isTyped(c) ? Trains::stationName(values[c - 'a']) : String40(params[c - 'a']);
   }
 };
 
 namespace Commands {
-  typedef std::string (*CommandFunc)(const Command &);
+  typedef void (*CommandFunc)(const Command &, Response &);
 
-  map<std::string, CommandFunc> commandMap;
+  struct Handler {
+    CommandFunc func;
+    bool readOnly = false; //may run on a snapshot alongside writes. see Executor
+    bool exclusive = false; //replaces the files under the stores, so no reader may run alongside
+    Histogram latency; //in nanoseconds. recorded only if Stats::enabled
+    IoCounters io; //i/o of all stores caused by the command, including the write-back after it
+  };
+
+  map<std::string, Handler> commandMap;
   bool running = true;
 
-  std::string addUser(const Command &command) {
+  void addUser(const Command &command, Response &out) {
     Account newAccount(command.getParam('u'), command.getParam('p'), command.getParam('n'), command.getParam('m'),
                        command.getIntParam('g'));
     if (AccountStorage::empty()) {
       newAccount.privilege = 10;
       AccountStorage::add(newAccount);
-      return "0";
+      out.code(0);
+      return;
     } else {
       auto currentAccount = Accounts::getLogged(command.getParam('c'));
       if (!currentAccount.present || currentAccount.value->privilege <= newAccount.privilege) {
-        return "-1";
+        out.code(-1);
+        return;
       }
-      return AccountStorage::add(newAccount) ? "0" : "-1";
+      out.code(AccountStorage::add(newAccount) ? 0 : -1);
     }
   }
 
-  std::string login(const Command &command) {
-    return Accounts::login(command.getParam('u'), command.getParam('p')) ? "0" : "-1";
+  void login(const Command &command, Response &out) {
+    out.code(Accounts::login(command.getParam('u'), command.getParam('p')) ? 0 : -1);
   }
 
-  std::string logout(const Command &command) {
-    return Accounts::logout(command.getParam('u')) ? "0" : "-1";
+  void logout(const Command &command, Response &out) {
+    out.code(Accounts::logout(command.getParam('u')) ? 0 : -1);
   }
 
-  std::string queryProfile(const Command &command) {
+  void queryProfile(const Command &command, Response &out) {
     auto currentAccount = Accounts::getLogged(command.getParam('c'));
     auto queryAccount = AccountStorage::get(command.getParam('u'), false);
     if (!currentAccount.present || !queryAccount.present ||
         (currentAccount.value->userID != queryAccount.value->userID &&
          currentAccount.value->privilege <= queryAccount.value->privilege)) {
-      return "-1";
+      out.code(-1);
+      return;
     }
-    std::cout << *queryAccount.value;
-    return "";
+    out.account(*queryAccount.value);
   }
 
-  std::string modifyProfile(const Command &command) {
+  void modifyProfile(const Command &command, Response &out) {
     auto currentAccount = Accounts::getLogged(command.getParam('c'));
     auto modifyAccount = AccountStorage::get(command.getParam('u'), true);
     if (!currentAccount.present || !modifyAccount.present ||
         (currentAccount.value->userID != modifyAccount.value->userID &&
          currentAccount.value->privilege <= modifyAccount.value->privilege)) {
-      return "-1";
+      out.code(-1);
+      return;
     }
     Account* newAccount = modifyAccount.value;
-    if (!command.getParam('g').empty()) {
+    if (command.hasParam('g')) {
       if (command.getIntParam('g') >= currentAccount.value->privilege) {
-        return "-1";
+        out.code(-1);
+        return;
       }
       newAccount->privilege = command.getIntParam('g');
     }
@@ -111,11 +158,10 @@ namespace Commands {
     if (!command.getParam('m').empty()) {
       newAccount->mailAddr = command.getParam('m');
     }
-    std::cout << *newAccount;
-    return "";
+    out.account(*newAccount);
   }
 
-  std::string addTrain(const Command &command) {
+  void addTrain(const Command &command, Response &out) {
     int stationNum = command.getIntParam('n');
     vector<string> v = parseVector(command.getParam('d'), '|', 2);
     int startDate = parseDate(v[0]);
@@ -143,69 +189,69 @@ namespace Commands {
         newTrain.departureTimes[i] = currentTime;
       }
     }
-    return Trains::addTrain(newTrain) ? "0" : "-1";
+    out.code(Trains::addTrain(newTrain) ? 0 : -1);
   }
 
-  std::string deleteTrain(const Command &command) {
-    return Trains::deleteTrain(command.getParam('i')) ? "0" : "-1";
+  void deleteTrain(const Command &command, Response &out) {
+    out.code(Trains::deleteTrain(command.getParam('i')) ? 0 : -1);
   }
 
-  std::string releaseTrain(const Command &command) {
-    return Trains::releaseTrain(command.getParam('i')) ? "0" : "-1";
+  void releaseTrain(const Command &command, Response &out) {
+    out.code(Trains::releaseTrain(command.getParam('i')) ? 0 : -1);
   }
 
-  std::string queryTrain(const Command &command) {
-    bool isReleased;
+  void queryTrain(const Command &command, Response &out) {
     auto train = Trains::getTrain(command.getParam('i'), false, false);
     if (!train.present) {
-      return "-1";
+      out.code(-1);
+      return;
     }
     TrainInfo &trainInfo = *train.value;
-    int trainNum = trainInfo.toTrainNum(parseDate(command.getParam('d')));
+    int trainNum = trainInfo.toTrainNum(command.getDateParam('d'));
     if (trainNum < 0 || trainNum >= trainInfo.totalCount) {
-      return "-1";
+      out.code(-1);
+      return;
     }
-    std::cout << trainInfo.trainID << ' ' << trainInfo.type << '\n';
+    out.train(trainInfo.trainID, trainInfo.type);
     for (int i = 0; i < trainInfo.stationNum; i++) {
-      std::cout << trainInfo.stationNames[i] << ' '
-                << trainInfo.getArrival(trainNum, i) << " -> "
-                << trainInfo.getDeparture(trainNum, i) << ' '
-                << trainInfo.prices[i] << ' ';
-      if (i < trainInfo.stationNum - 1) {
-        std::cout << trainInfo.getSeat(trainNum, i) << '\n';
-      } else {
-        std::cout << "x";
-      }
+      out.stop(trainInfo.stationNames[i], trainInfo.getArrival(trainNum, i), trainInfo.getDeparture(trainNum, i),
+               trainInfo.prices[i], i < trainInfo.stationNum - 1 ? trainInfo.getSeat(trainNum, i) : -1);
     }
-    return "";
   }
 
-  std::string buyTicket(const Command &command) {
+  void buyTicket(const Command &command, Response &out) {
     String20 userID = command.getParam('u');
     String20 trainID = command.getParam('i');
-    auto train = Trains::getTrain(trainID, true, true);
+    auto train = Trains::getTrain(trainID, false, true); //the seats sold are kept apart from the train
     if (!train.present) {
-      return "-1";
+      out.code(-1);
+      return;
     }
     auto user = Accounts::getLogged(userID);
     if (!user.present) {
-      return "-1";
+      out.code(-1);
+      return;
     }
     TrainInfo &trainInfo = *train.value;
-    int startStation = trainInfo.searchStationIndex(command.getParam('f'));
-    int endStation = trainInfo.searchStationIndex(command.getParam('t'));
+    String40 from = command.getStationParam('f');
+    String40 to = command.getStationParam('t');
+    int startStation = trainInfo.searchStationIndex(from.toString());
+    int endStation = trainInfo.searchStationIndex(to.toString());
     if (startStation < 0 || endStation < 0 || startStation >= endStation) {
-      return "-1";
+      out.code(-1);
+      return;
     }
-    int trainNum = trainInfo.findTrainNum(parseDate(command.getParam('d')), startStation);
+    int trainNum = trainInfo.findTrainNum(command.getDateParam('d'), startStation);
     if (trainNum < 0 || trainNum >= trainInfo.totalCount) {
-      return "-1";
+      out.code(-1);
+      return;
     }
     int count = command.getIntParam('n');
     if(count > trainInfo.seatNum) {
-      return "-1";
+      out.code(-1);
+      return;
     }
-    bool shouldQueue = command.getParam('q') == "true";
+    bool shouldQueue = command.getFlagParam('q', "true");
     int price = trainInfo.buy(trainNum, startStation, endStation, count);
     Order order = {
       userID,
@@ -213,10 +259,10 @@ namespace Commands {
       trainNum,
       price < 0 ? 1 : 0,
       startStation,
-      command.getParam('f'),
+      from,
       trainInfo.getDeparture(trainNum, startStation),
       endStation,
-      command.getParam('t'),
+      to,
       trainInfo.getArrival(trainNum, endStation),
       trainInfo.getPrice(startStation, endStation),
       count
@@ -224,80 +270,400 @@ namespace Commands {
     if (price < 0) {
       if (shouldQueue) {
         Orders::addOrder(order);
-        return "queue";
+        out.queued();
+        return;
       }
-      return "-1";
+      out.code(-1);
+      return;
     }
     Orders::addOrder(order);
-    std::cout << price;
-    return "";
+    out.code(price);
   }
 
-  std::string queryTicket(const Command &command) {
-    Trains::queryTicket(command.getParam('s'), command.getParam('t'), parseDate(command.getParam('d')),
-                        command.getParam('p') == "cost");
-    return "";
+  void queryTicket(const Command &command, Response &out) {
+    Trains::queryTicket(command.getStationParam('s'), command.getStationParam('t'), command.getDateParam('d'),
+                        command.getFlagParam('p', "cost"), out);
   }
 
-  std::string queryOrder(const Command &command) {
+  void queryOrder(const Command &command, Response &out) {
     auto user = Accounts::getLogged(command.getParam('u'));
     if (!user.present) {
-      return "-1";
+      out.code(-1);
+      return;
     }
-    Orders::printOrders(user.value->userID);
-    return "";
+    Orders::printOrders(user.value->userID, out);
   }
 
-  std::string refundTicket(const Command &command) {
+  void refundTicket(const Command &command, Response &out) {
     auto user = Accounts::getLogged(command.getParam('u'));
     if (!user.present) {
-      return "-1";
+      out.code(-1);
+      return;
+    }
+    out.code(Orders::refundOrder(user.value->userID, command.hasParam('n') ? command.getIntParam('n') : 1) ? 0 : -1);
+  }
+
+  void queryTransfer(const Command &command, Response &out) {
+    if (!Trains::queryTransfer(command.getStationParam('s'), command.getStationParam('t'), command.getDateParam('d'),
+                               command.getFlagParam('p', "cost"), out)) {
+      out.code(0);
     }
-    return Orders::refundOrder(user.value->userID, command.getParam('n').empty() ? 1 : command.getIntParam('n')) ? "0" : "-1";
   }
 
-  std::string queryTransfer(const Command &command) {
-    return Trains::queryTransfer(command.getParam('s'), command.getParam('t'), parseDate(command.getParam('d')),
-                                 command.getParam('p') == "cost") ? "" : "0";
+  void queryStation(const Command &command, Response &out) { //interned id of a station for the binary protocol
+    out.code(Trains::findStation(command.getParam('s')));
   }
 
-  std::string clean(const Command &command) {
+  std::string formatMicros(unsigned long long ns) {
+    return toStringInt(ns / 1000) + "." + toStringInt(ns % 1000 / 10, 2);
+  }
+
+  const std::string STATS_DIRECTORY = "storage/stats/";
+
+  //the path of a file written by stats. any client may name one, so only a plain name is taken, and it is put under
+  //STATS_DIRECTORY. empty if the name is not plain
+  std::string statsPath(const std::string &name) {
+    if (name.empty() || name.length() > 64 || !isalnum((unsigned char) name[0])) {
+      return "";
+    }
+    for (char c: name) {
+      if (!isalnum((unsigned char) c) && c != '.' && c != '_' && c != '-') {
+        return "";
+      }
+    }
+    std::filesystem::create_directories(STATS_DIRECTORY);
+    return STATS_DIRECTORY + name;
+  }
+
+  //report command latency, i/o per command and per store
+  //-e true/false switches timing. -f writes the report to a file instead. -t starts a trace log in a file, or stops it
+  //if empty. files are named plainly and go under STATS_DIRECTORY
+  void stats(const Command &command, Response &out) {
+    std::string tracePath = command.hasParam('t') ? statsPath(command.getParam('t')) : "";
+    std::string reportPath = command.hasParam('f') ? statsPath(command.getParam('f')) : "";
+    if ((command.hasParam('t') && !command.getParam('t').empty() && tracePath.empty()) ||
+        (command.hasParam('f') && reportPath.empty())) {
+      out.code(-1);
+      return;
+    }
+    if (command.hasParam('e')) {
+      Stats::enabled = command.getFlagParam('e', "true");
+    }
+    if (command.hasParam('t')) {
+      Stats::trace.close();
+      Stats::trace.clear();
+      if (!tracePath.empty()) {
+        Stats::trace.open(tracePath, std::ios::app);
+      }
+    }
+    std::string report = "command count mean(us) p50(us) p99(us) p999(us) max(us)";
+    for (auto it = commandMap.begin(); it != commandMap.end(); ++it) {
+      const Histogram &h = it->second.latency;
+      if (h.count()) {
+        report += "\n" + it->first + ' ' + toStringInt(h.count()) + ' ' + formatMicros(h.mean()) + ' ' +
+                  formatMicros(h.percentile(0.5)) + ' ' + formatMicros(h.percentile(0.99)) + ' ' +
+                  formatMicros(h.percentile(0.999)) + ' ' + formatMicros(h.max());
+      }
+    }
+    report += std::string("\ncommand ") + Stats::COUNTER_NAMES;
+    for (auto it = commandMap.begin(); it != commandMap.end(); ++it) {
+      if (it->second.io.touchesFile() || it->second.io.hits) {
+        report += "\n" + it->first + ' ' + it->second.io.toString();
+      }
+    }
+    report += std::string("\nstore ") + Stats::COUNTER_NAMES;
+    for (size_t i = 0; i < Stats::stores.size(); i++) {
+      report += "\n" + Stats::stores[i]->name + ' ' + Stats::stores[i]->toString();
+    }
+    if (command.hasParam('f')) {
+      std::ofstream file(reportPath);
+      file << report << '\n';
+      out.code(file ? 0 : -1);
+    } else {
+      out.text(report);
+    }
+  }
+
+  void clean(const Command &command, Response &out) {
     throw;
-    return "0";
   }
 
-  std::string exit(const Command &command) {
+  void exit(const Command &command, Response &out) {
     running = false;
-    return "bye";
+    out.bye();
+  }
+
+  //online compaction of the trees, one after another (see compactStep in the trees). the executor runs a step
+  //between commands, which copies at most compactionRate bytes a second, and swaps a tree in once it is copied.
+  //the hash maps and the plain stores never free a record, so they have no holes to close
+  constexpr int COMPACTION_TREES = 4;
+  constexpr long long DEFAULT_COMPACTION_RATE = 16 << 20;
+  int compacting = -1; //the tree being compacted, or -1
+  long long compactionRate;
+  long long compactionBudget; //bytes which may be copied now. negative after a step overran it
+  std::chrono::steady_clock::time_point compactionClock;
+
+  template<typename F>
+  void onTree(int i, F f) {
+    switch (i) {
+      case 0:
+        return f(Orders::orderMap);
+      case 1:
+        return f(Orders::orderQueueMap);
+      case 2:
+        return f(Trains::stationMap);
+      default:
+        return f(Trains::stationIdMap);
+    }
+  }
+
+  void cancelCompaction() {
+    if (compacting != -1) {
+      onTree(compacting, [](auto &tree) { tree.cancelCompaction(); });
+      compacting = -1;
+    }
+  }
+
+  //whether a step has copied the whole tree, which must then be swapped in by finishCompaction
+  bool compactStep() {
+    if (compacting == -1) {
+      return false;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - compactionClock).count();
+    compactionClock = now;
+    compactionBudget = std::min(compactionBudget + (long long) (seconds * compactionRate), compactionRate / 10);
+    if (compactionBudget <= 0) {
+      return false;
+    }
+    bool copied;
+    onTree(compacting, [&copied](auto &tree) { copied = tree.compactStep(compactionBudget); });
+    return copied;
+  }
+
+  void finishCompaction() { //no reader may be running
+    onTree(compacting, [](auto &tree) { tree.finishCompaction(); });
+    if (++compacting == COMPACTION_TREES) {
+      compacting = -1;
+      return;
+    }
+    onTree(compacting, [](auto &tree) { tree.beginCompaction(); });
+  }
+
+  //the rewrite replaces files under the named snapshots, so none may exist
+  void compact(const Command &command, Response &out) {
+    if (compacting != -1 || !NamedSnapshots::names.empty()) {
+      out.code(-1);
+      return;
+    }
+    compactionRate = command.hasParam('r') ? (long long) command.getIntParam('r') << 20 : DEFAULT_COMPACTION_RATE;
+    if (compactionRate <= 0) {
+      out.code(-1);
+      return;
+    }
+    compacting = 0;
+    compactionBudget = 0;
+    compactionClock = std::chrono::steady_clock::now();
+    onTree(compacting, [](auto &tree) { tree.beginCompaction(); });
+    out.code(0);
+  }
+
+  void checkCache() { //write back caches between commands
+    AccountStorage::accountMap.checkCache();
+    Orders::orderHeap.checkCache();
+    Orders::orderMap.checkCache();
+    Orders::orderQueueMap.checkCache();
+    Trains::unreleasedTrainMap.checkCache();
+    Trains::releasedTrainMap.checkCache();
+    Trains::stationMap.checkCache();
+    Trains::trainDataFile.checkCache();
+    Trains::seatDataFile.checkCache();
+    Trains::stationIdMap.checkCache();
+    Trains::stationNameFile.checkCache();
+  }
+
+  void checkpoint() { //write everything back, so that the files alone hold the system
+    AccountStorage::accountMap.checkpoint();
+    Orders::orderHeap.checkpoint();
+    Orders::orderMap.checkpoint();
+    Orders::orderQueueMap.checkpoint();
+    Trains::unreleasedTrainMap.checkpoint();
+    Trains::releasedTrainMap.checkpoint();
+    Trains::stationMap.checkpoint();
+    Trains::trainDataFile.checkpoint();
+    Trains::seatDataFile.checkpoint();
+    Trains::stationIdMap.checkpoint();
+    Trains::stationNameFile.checkpoint();
+  }
+
+  void reload() { //read everything again after the files have changed. users are logged out
+    cancelCompaction();
+    AccountStorage::accountMap.reload();
+    Orders::orderHeap.reload();
+    Orders::orderMap.reload();
+    Orders::orderQueueMap.reload();
+    Trains::unreleasedTrainMap.reload();
+    Trains::releasedTrainMap.reload();
+    Trains::stationMap.reload();
+    Trains::trainDataFile.reload();
+    Trains::seatDataFile.reload();
+    Trains::stationIdMap.reload();
+    Trains::stationNameFile.reload();
+    Accounts::currentAccounts.clear();
+  }
+
+  void createSnapshot(const Command &command, Response &out) {
+    cancelCompaction();
+    checkpoint();
+    out.code(NamedSnapshots::create(command.getParam('i')) ? 0 : -1);
+  }
+
+  void restoreSnapshot(const Command &command, Response &out) {
+    if (!NamedSnapshots::restore(command.getParam('i'))) {
+      out.code(-1);
+      return;
+    }
+    reload();
+    out.code(0);
+  }
+
+  //check every record of every store against its checksum. there is no log to repair a single record from, so with -i
+  //a corrupt record rolls every store back to that named snapshot, since the stores refer to one another. whatever
+  //was done since the snapshot is lost, and users are logged out
+  void scrub(const Command &command, Response &out) {
+    checkpoint();
+    list<unsigned long long> before;
+    for (size_t i = 0; i < Stats::stores.size(); i++) {
+      before.push_back(Stats::stores[i]->corrupt);
+    }
+    int bad = AccountStorage::accountMap.scrub() + Orders::orderHeap.scrub() + Orders::orderMap.scrub() +
+              Orders::orderQueueMap.scrub() + Trains::unreleasedTrainMap.scrub() + Trains::releasedTrainMap.scrub() +
+              Trains::stationMap.scrub() + Trains::trainDataFile.scrub() + Trains::seatDataFile.scrub() +
+              Trains::stationIdMap.scrub() + Trains::stationNameFile.scrub();
+    std::string report = "corrupt " + toStringInt(bad);
+    for (size_t i = 0; i < Stats::stores.size(); i++) {
+      if (Stats::stores[i]->corrupt != before[i]) {
+        report += "\n" + Stats::stores[i]->name + ' ' + toStringInt((int) (Stats::stores[i]->corrupt - before[i]));
+      }
+    }
+    if (bad > 0 && command.hasParam('i')) {
+      if (!NamedSnapshots::restore(command.getParam('i'))) {
+        out.code(-1);
+        return;
+      }
+      reload();
+      report += "\nrestored " + command.getParam('i') + ", all changes since are lost";
+    }
+    out.text(report);
+  }
+
+  void deleteSnapshot(const Command &command, Response &out) {
+    out.code(NamedSnapshots::remove(command.getParam('i')) ? 0 : -1);
+  }
+
+  //compress the seats of the trains which started before -d into read-only files (see DatedStorage). the system keeps
+  //no clock, so it is told which days are gone. they may still be sold and refunded, which thaws them. refused while
+  //there are named snapshots, since the plain files go
+  void freeze(const Command &command, Response &out) {
+    if (!NamedSnapshots::names.empty()) {
+      out.code(-1);
+      return;
+    }
+    Trains::seatDataFile.freeze(command.getDateParam('d'));
+    out.code(0);
   }
 
   void init() {
-    commandMap["add_user"] = addUser;
-    commandMap["login"] = login;
-    commandMap["logout"] = logout;
-    commandMap["query_profile"] = queryProfile;
-    commandMap["modify_profile"] = modifyProfile;
-    commandMap["exit"] = exit;
-    commandMap["add_train"] = addTrain;
-    commandMap["delete_train"] = deleteTrain;
-    commandMap["release_train"] = releaseTrain;
-    commandMap["query_train"] = queryTrain;
-    commandMap["buy_ticket"] = buyTicket;
-    commandMap["query_order"] = queryOrder;
-    commandMap["query_ticket"] = queryTicket;
-    commandMap["refund_ticket"] = refundTicket;
-    commandMap["query_transfer"] = queryTransfer;
-    commandMap["clean"] = clean;
-  }
-
-  std::string run(const std::string &s) {
-    Command command(s);
+    NamedSnapshots::init();
+    commandMap["add_user"] = {addUser};
+    commandMap["login"] = {login};
+    commandMap["logout"] = {logout};
+    commandMap["query_profile"] = {queryProfile, true};
+    commandMap["modify_profile"] = {modifyProfile};
+    commandMap["exit"] = {exit};
+    commandMap["add_train"] = {addTrain};
+    commandMap["delete_train"] = {deleteTrain};
+    commandMap["release_train"] = {releaseTrain};
+    commandMap["query_train"] = {queryTrain, true};
+    commandMap["buy_ticket"] = {buyTicket};
+    commandMap["query_order"] = {queryOrder, true};
+    commandMap["query_ticket"] = {queryTicket, true};
+    commandMap["refund_ticket"] = {refundTicket};
+    commandMap["query_transfer"] = {queryTransfer, true};
+    commandMap["query_station"] = {queryStation, true};
+    commandMap["stats"] = {stats};
+    commandMap["clean"] = {clean};
+    commandMap["create_snapshot"] = {createSnapshot, false, true};
+    commandMap["restore_snapshot"] = {restoreSnapshot, false, true};
+    commandMap["delete_snapshot"] = {deleteSnapshot, false, true};
+    commandMap["scrub"] = {scrub, false, true};
+    commandMap["compact"] = {compact};
+    commandMap["freeze"] = {freeze, false, true};
+  }
+
+  bool isReadOnly(const Command &command) {
+    auto it = commandMap.find(command.name);
+    return it != commandMap.end() && it->second.readOnly;
+  }
+
+  bool isExclusive(const Command &command) {
+    auto it = commandMap.find(command.name);
+    return it != commandMap.end() && it->second.exclusive;
+  }
+
+  //run a read-only command on the thread of a snapshot reader. nothing is written back or counted
+  void read(const Command &command, Response &out) {
+    out.begin(command);
+    commandMap.find(command.name)->second.func(command, out);
+    out.end();
+    arena::local().reset();
+  }
+
+  //run a command and write back the caches after it. the scratch containers of a command live in the arena of its
+  //thread, which is taken back as a whole once the response is flushed, since the response may still point into it
+  //i/o and latency, which includes the write-back, are attributed to the command if stats or tracing are on
+  void run(const Command &command, Response &out) {
     auto it = commandMap.find(command.name);
-    std::cout << command.timestamp << ' ';
+    out.begin(command);
     if (it == commandMap.end()) {
-      return "-1";
+      out.code(-1);
+      out.end();
+      return;
+    }
+    if (!Stats::enabled && !Stats::tracing()) {
+      it->second.func(command, out);
+      out.end();
+      arena::local().reset();
+      checkCache();
+      return;
+    }
+    Stats::mark();
+    auto start = std::chrono::steady_clock::now();
+    it->second.func(command, out);
+    out.end();
+    arena::local().reset();
+    checkCache();
+    auto stop = std::chrono::steady_clock::now();
+    unsigned long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    if (Stats::enabled) {
+      it->second.latency.record(ns);
+    }
+    if (Stats::tracing()) {
+      Stats::trace << (command.timestamp.empty() ? "[" + toStringInt(command.stamp) + "]" : command.timestamp) << ' '
+                   << command.name << ' ' << formatMicros(ns);
+    }
+    for (size_t i = 0; i < Stats::stores.size(); i++) {
+      IoCounters delta = *Stats::stores[i] - Stats::stores[i]->mark;
+      it->second.io += delta;
+      if (Stats::tracing() && (delta.touchesFile() || delta.hits)) {
+        Stats::trace << ' ' << Stats::stores[i]->name << ':' << delta.reads << ',' << delta.writes << ','
+                     << delta.hits << ',' << delta.misses << ',' << delta.seeks << ',' << delta.bytesRead << ','
+                     << delta.bytesWritten;
+      }
+    }
+    if (Stats::tracing()) {
+      Stats::trace << '\n';
     }
-    return it->second(command);
   }
 }
 
@@ -0,0 +1,161 @@
+#ifndef TICKETSYSTEM2024_EXECUTOR_HPP
+#define TICKETSYSTEM2024_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "Command.hpp"
+#include "util/Snapshot.hpp"
+
+//run read-only commands on worker threads while the calling thread goes on with the others in order.
+//a reader sees the stores as of its dispatch (see Snapshot), so writes never wait for it.
+//results are written in command order: a command is buffered while an earlier one is still running.
+//R is the response type of the protocol, built on an ostream
+template<typename R>
+class Executor {
+  struct Task {
+    Command command;
+    std::ostringstream buffer;
+    R out{buffer};
+    Accounts::Sessions sessions;
+    int slot = -1; //snapshot reader slot. -1 for a write, which is done once it is queued
+    bool done = false;
+  };
+
+  std::ostream &os;
+  R direct; //for commands with nothing before them
+  bool flush; //flush os after each result, for callers which wait for it
+  int threadCount;
+  std::thread *workers;
+  std::mutex latch; //guards everything below
+  std::condition_variable ready; //a task waits for a worker, or the executor stops
+  std::condition_variable finished; //a reader is done
+  map<unsigned long long, Task *> pending; //tasks not written yet, by sequence
+  map<unsigned long long, Task *> queue; //readers waiting for a worker, by sequence
+  unsigned long long sequence = 0;
+  bool stopping = false;
+
+  void emit() { //under latch. write the results which are no longer behind a running reader
+    bool wrote = false;
+    while (!pending.empty() && pending.begin()->second->done) {
+      Task *task = pending.begin()->second;
+      os << task->buffer.view();
+      pending.erase(pending.begin());
+      delete task;
+      wrote = true;
+    }
+    if (wrote && flush) {
+      os.flush();
+    }
+  }
+
+  void work() {
+    while (true) {
+      Task *task;
+      {
+        std::unique_lock guard(latch);
+        ready.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) {
+          return;
+        }
+        task = queue.begin()->second;
+        queue.erase(queue.begin());
+      }
+      {
+        Snapshot::Reader reader(task->slot);
+        Accounts::sessions = &task->sessions;
+        Commands::read(task->command, task->out);
+        Accounts::sessions = nullptr;
+      }
+      Snapshot::end(task->slot);
+      {
+        std::lock_guard guard(latch);
+        task->done = true;
+        emit();
+      }
+      finished.notify_all();
+    }
+  }
+
+  void wait() { //until every reader is done and written
+    std::unique_lock guard(latch);
+    finished.wait(guard, [this] { return pending.empty(); });
+  }
+
+  void dispatch(const Command &command) {
+    //counters are only attributed right to commands running alone, and snapshot commands replace what readers see
+    if (Stats::enabled || Stats::tracing() || Commands::isExclusive(command)) {
+      wait();
+      Commands::run(command, direct);
+      return;
+    }
+    if (threadCount > 0 && Commands::isReadOnly(command)) {
+      Task *task = new Task;
+      task->command = command;
+      task->sessions.capture(command.getParam('c'));
+      task->sessions.capture(command.getParam('u'));
+      std::unique_lock guard(latch);
+      finished.wait(guard, [&] { return (task->slot = Snapshot::begin()) >= 0; });
+      pending.insert({sequence, task});
+      queue.insert({sequence, task});
+      sequence++;
+      guard.unlock();
+      ready.notify_one();
+      return;
+    }
+    bool alone;
+    {
+      std::lock_guard guard(latch);
+      alone = pending.empty();
+    }
+    if (alone) { //no reader is running, so nobody else writes to os
+      Commands::run(command, direct);
+      return;
+    }
+    Task *task = new Task;
+    Commands::run(command, task->out);
+    std::lock_guard guard(latch);
+    task->done = true;
+    pending.insert({sequence++, task});
+    emit();
+  }
+
+public:
+  Executor(std::ostream &os, int threadCount, bool flush) : os(os), direct(os), flush(flush),
+                                                            threadCount(threadCount),
+                                                            workers(new std::thread[threadCount]) {
+    for (int i = 0; i < threadCount; i++) {
+      workers[i] = std::thread([this] { work(); });
+    }
+  }
+
+  Executor(const Executor &) = delete;
+
+  Executor &operator=(const Executor &) = delete;
+
+  ~Executor() {
+    wait();
+    {
+      std::lock_guard guard(latch);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (int i = 0; i < threadCount; i++) {
+      workers[i].join();
+    }
+    delete[] workers;
+  }
+
+  //must be called by one thread, which becomes the writer thread. a running compaction goes on between commands,
+  //and its swap waits for the readers like the exclusive commands do
+  void run(const Command &command) {
+    dispatch(command);
+    if (Commands::compactStep()) {
+      wait();
+      Commands::finishCompaction();
+    }
+  }
+};
+
+#endif
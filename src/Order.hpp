@@ -23,6 +23,11 @@ struct Order {
   int price;
   int num;
   using INDEX = String20;
+  using ENCODE = Order; //stored as it is
+
+  Order encode() const {
+    return *this;
+  }
 
   const INDEX& index() const {
     return userID;
@@ -44,6 +49,19 @@ struct Order {
   }
 };
 
+//what the order tree keeps of an order: the user, the status, which changes, and where the rest is in orderHeap.
+//orders are never removed, so the heap only grows, and leaves hold many keys instead of a dozen orders
+struct OrderKey {
+  String20 userID;
+  int status;
+  int record;
+  using INDEX = String20;
+
+  const INDEX& index() const {
+    return userID;
+  }
+};
+
 struct OrderQueue {
   pair<String20, int> train; //trainID, trainNum
   using INDEX = pair<String20, int>;
@@ -55,27 +73,39 @@ struct OrderQueue {
 };
 
 namespace Orders {
-  PersistentMultiMap<Order> orderMap("order");
+  //the cache holds whole blocks, and the orders of a user lie all over the heap, so it is larger than for single records
+  PackedStorage<Order, (1 << 22) / sizeof(Order)> orderHeap("order_heap");
+  PersistentMultiMap<OrderKey> orderMap("order");
   PersistentMultiMap<OrderQueue> orderQueueMap("order_queue");
 
+  //the order a key stands for. the status in the heap is the one at purchase, the key has the current one
+  Order getOrder(const OrderKey &key) {
+    Order ret = *orderHeap.get(key.record, false);
+    ret.status = key.status;
+    return ret;
+  }
+
   void addOrder(Order &order) { //success or pending
-    int tick = orderMap.pushFront(order);
+    int tick = orderMap.pushFront(OrderKey{order.userID, order.status, orderHeap.write(order)});
     if (order.status == 1) {
       orderQueueMap.pushBack(OrderQueue{{order.trainID, order.trainNum}, order.userID, tick});
     }
   }
 
-  void printOrders(const String20 &id) {
+  void printOrders(const String20 &id, Response &out) {
     auto it1 = orderMap.find(id); //find the first order of the user
     auto it2 = it1;
     int count = 0;
+    list<int> records;
     while (!it1.end() && it1->val.index() == id) {
       count++;
+      records.push_back(it1->val.record);
       ++it1;
     }
-    std::cout << count;
+    orderHeap.fetch(records); //the orders lie all over the heap, so their blocks are read in one batch
+    out.count(count);
     for (int i = 0; i < count; i++) {
-      std::cout << '\n' << it2->val;
+      out.order(getOrder(it2->val));
       ++it2;
     }
   }
@@ -89,16 +119,17 @@ namespace Orders {
       return false;
     }
     itNow.markDirty();
-    Order &orderNow = itNow->val;
-    if(orderNow.status == 1) {
-      orderNow.status = 2;
+    OrderKey &keyNow = itNow->val;
+    if(keyNow.status == 1) {
+      keyNow.status = 2;
       return true;
     }
-    if(orderNow.status == 2) {
+    if(keyNow.status == 2) {
       return false;
     }
-    orderNow.status = 2;
-    auto train = Trains::getTrain(orderNow.trainID, true, true);
+    keyNow.status = 2;
+    Order orderNow = getOrder(keyNow);
+    auto train = Trains::getTrain(orderNow.trainID, false, true);
     if (!train.present) {
       throw;
     }
@@ -111,14 +142,15 @@ namespace Orders {
       if(!orderPendingRef.present) {
         throw;
       }
-      Order &orderPending = orderPendingRef.value->val;
-      if (orderPending.status == 1) {
+      OrderKey &keyPending = orderPendingRef.value->val;
+      if (keyPending.status == 1) {
+        Order orderPending = getOrder(keyPending);
         if (trainInfo.buy(orderPending.trainNum, orderPending.fromId, orderPending.toId, orderPending.num) >= 0) {
           orderPendingRef.value.markDirty();
-          orderPending.status = 0;
+          keyPending.status = 0;
         }
       }
-      if (orderPending.status != 1) {
+      if (keyPending.status != 1) {
         toErase.push_back(itQueue->val.tick);
       }
       ++itQueue;
@@ -1,29 +1,34 @@
 #include "Command.hpp"
+#include "Executor.hpp"
 #include "Account.hpp"
 #include "Order.hpp"
 #include "Train.hpp"
+#include "protocol/TextProtocol.hpp"
+#include "protocol/BinaryProtocol.hpp"
 
-void checkCache() {
-  AccountStorage::accountMap.checkCache();
-  Orders::orderMap.checkCache();
-  Orders::orderQueueMap.checkCache();
-  Trains::unreleasedTrainMap.checkCache();
-  Trains::releasedTrainMap.checkCache();
-  Trains::stationMap.checkCache();
-  Trains::trainDataFile.checkCache();
-  Trains::seatDataFile.checkCache();
-}
-
-int main() {
+int main(int argc, char *argv[]) {
   std::ios::sync_with_stdio(false);
   std::cin.tie(nullptr);
   std::cout.tie(nullptr);
   Commands::init();
+  Stats::enabled = getenv("TICKET_STATS") != nullptr;
+  if (getenv("TICKET_TRACE")) {
+    Stats::trace.open(getenv("TICKET_TRACE"), std::ios::app);
+  }
+  int threads = getenv("TICKET_THREADS") ? std::max(0, atoi(getenv("TICKET_THREADS"))) : 0; //for read-only commands
+  if (argc > 1 && std::string(argv[1]) == "--binary") {
+    Executor<BinaryResponse> executor(std::cout, threads, true);
+    Command command;
+    while (Commands::running && BinaryProtocol::readCommand(std::cin, command)) {
+      executor.run(command);
+    }
+    return 0;
+  }
+  Executor<TextResponse> executor(std::cout, threads, false);
   while (Commands::running) {
     std::string input;
     getline(std::cin, input);
-    std::cout << Commands::run(input) << '\n';
-    checkCache();
+    executor.run(Command(input));
   }
   return 0;
-}
\ No newline at end of file
+}
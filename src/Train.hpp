@@ -6,8 +6,11 @@
 #define TICKETSYSTEM2024_TRAIN_HPP
 
 #include "persistent_data_structure/PersistentMap.hpp"
+#include "persistent_data_structure/PersistentHashMap.hpp"
 #include "persistent_data_structure/PersistentSet.hpp"
-#include "file_storage/SuperFileBlock.hpp"
+#include "file_storage/PackedStorage.hpp"
+#include "file_storage/DatedStorage.hpp"
+#include "protocol/Response.hpp"
 #include "util/Util.hpp"
 
 struct Train {
@@ -20,6 +23,16 @@ struct Train {
   }
 };
 
+struct StationId {
+  String40 station; //station name
+  int id; //interned id, the index of the name in stationNameFile
+  using INDEX = String40;
+
+  const INDEX &index() const {
+    return station;
+  }
+};
+
 struct Seats {
   int seats[30];
 
@@ -41,10 +54,18 @@ struct Station {
   int trainData; //where train data is stored
   int stationNum; //index of the station in the train
   auto operator<=>(const Station &rhs) const = default;
+
+  friend void encodeKey(unsigned char *&out, const Station &key) {
+    encodeKey(out, key.station);
+    encodeKey(out, key.trainData);
+    encodeKey(out, key.stationNum);
+  }
 };
 
+constexpr int SALE_DATES = 214; //06-01 to 12-31, the dates parseDate knows
+
 namespace Trains {
-  extern FileStorage<Seats, int, 0> seatDataFile;
+  extern DatedStorage<Seats, SALE_DATES> seatDataFile;
 }
 
 struct TrainInfoEncode {
@@ -58,7 +79,7 @@ struct TrainInfoEncode {
   short firstStartDate;
   short totalCount;
   char type;
-  int seatLoc;
+  int seatLocs[SALE_DATES]; //seatLocs[0] is -1 if the train is not released
 };
 
 struct TrainInfo {
@@ -73,22 +94,24 @@ struct TrainInfo {
   short firstStartDate;
   short totalCount; //total number of trains. from startDate to startDate + totalDate - 1
   char type; //type of the train
-  int seatLoc; //points to the start of the seat info of train 0. step = 1
+  vector<int> seatLocs; //the index of the seat info of train i among the seats of its start date. empty if not released
 
   TrainInfo() = default;
 
   TrainInfo(std::string trainID, int stationNum, int seatNum, int firstStartDate, int totalCount, std::string type) :
     trainID(std::move(trainID)), stationNum(stationNum), seatNum(seatNum), firstStartDate(firstStartDate),
     totalCount(totalCount), type(type[0]),
-    stationNames(stationNum), prices(stationNum), arrivalTimes(stationNum), departureTimes(stationNum),
-    seatLoc(-1) {}
+    stationNames(stationNum), prices(stationNum), arrivalTimes(stationNum), departureTimes(stationNum) {}
 
   explicit TrainInfo(const TrainInfoEncode &encode) :
     trainID(encode.trainID.toString()), stationNum(encode.stationNum), seatNum(encode.seatNum),
     firstStartDate(encode.firstStartDate),
     totalCount(encode.totalCount), type(encode.type),
     stationNames(stationNum), prices(stationNum), arrivalTimes(stationNum), departureTimes(stationNum),
-    seatLoc(encode.seatLoc) {
+    seatLocs(encode.seatLocs[0] < 0 ? 0 : totalCount) {
+    for (size_t i = 0; i < seatLocs.size(); i++) {
+      seatLocs[i] = encode.seatLocs[i];
+    }
     for (int i = 0; i < stationNum; i++) {
       stationNames[i] = encode.stationNames[i].toString();
       prices[i] = encode.prices[i];
@@ -98,7 +121,7 @@ struct TrainInfo {
   }
 
   TrainInfoEncode encode() const {
-    TrainInfoEncode ret;
+    TrainInfoEncode ret{}; //the unused stations are zeros, which compress away
     ret.trainID = trainID;
     ret.stationNum = stationNum;
     ret.seatNum = seatNum;
@@ -111,7 +134,10 @@ struct TrainInfo {
     ret.firstStartDate = firstStartDate;
     ret.totalCount = totalCount;
     ret.type = type;
-    ret.seatLoc = seatLoc;
+    ret.seatLocs[0] = -1;
+    for (size_t i = 0; i < seatLocs.size(); i++) {
+      ret.seatLocs[i] = seatLocs[i];
+    }
     return ret;
   }
 
@@ -159,11 +185,11 @@ struct TrainInfo {
   }
 
   Seats *getSeats(int trainNum, bool dirty) const {
-    return Trains::seatDataFile.get(seatLoc + trainNum, dirty);
+    return Trains::seatDataFile.get(firstStartDate + trainNum, seatLocs[trainNum], dirty);
   }
 
   int getSeat(int trainNum, int stationIndex) const {
-    return seatLoc < 0 ? seatNum : getSeats(trainNum, false)->operator[](stationIndex);
+    return seatLocs.empty() ? seatNum : getSeats(trainNum, false)->operator[](stationIndex);
   }
 
   int getMaxSeat(int trainNum, int startStationIndex, int endStationIndex) const {
@@ -186,9 +212,9 @@ struct TrainInfo {
         return -1;
       }
     }
-    getSeats(trainNum, true);
+    Seats &sold = *getSeats(trainNum, true); //elsewhere than seats if the day was frozen
     for (int i = startStationIndex; i < endStationIndex; i++) {
-      seats[i] -= num;
+      sold[i] -= num;
     }
     return num * getPrice(startStationIndex, endStationIndex);
   }
@@ -249,17 +275,44 @@ struct Line {
 };
 
 namespace Trains {
-  PersistentMap<Train> unreleasedTrainMap("unreleased_train");
-  PersistentMap<Train> releasedTrainMap("released_train");
+  PersistentHashMap<Train, 0, 16> unreleasedTrainMap("unreleased_train");
+  PersistentHashMap<Train, 0, 16> releasedTrainMap("released_train");
   PersistentSet<Station> stationMap("station");
-  SuperFileBlock<TrainInfo, 10000, 6500> trainDataFile("train_data");
-  FileStorage<Seats, int, 0> seatDataFile(0, "seat_data");
+  PackedStorage<TrainInfo, 6500> trainDataFile("train_data");
+  DatedStorage<Seats, SALE_DATES> seatDataFile("seat_data");
+  PersistentMap<StationId> stationIdMap("station_id");
+  FileStorage<String40, int, 0> stationNameFile(0, "station_name");
+
+  int internStation(const String40 &station) { //return the id of the station. assign a new one if absent
+    auto it = stationIdMap.get(station);
+    if (it.present) {
+      return it.value->id;
+    }
+    int id = stationNameFile.add(station);
+    stationIdMap.insert(StationId{station, id});
+    return id;
+  }
+
+  int findStation(const String40 &station) { //return -1 if the station is never mentioned
+    auto it = stationIdMap.get(station);
+    return it.present ? it.value->id : -1;
+  }
+
+  String40 stationName(int id) { //return an empty name for invalid id
+    if (id < 0 || id >= stationIdMap.size()) {
+      return {};
+    }
+    return *stationNameFile.get(id, false);
+  }
 
   bool addTrain(const TrainInfo &trainInfo) {
     String20 index = trainInfo.trainID;
     if (unreleasedTrainMap.get(index).present || releasedTrainMap.get(index).present) {
       return false;
     }
+    for (int i = 0; i < trainInfo.stationNum; i++) {
+      internStation(trainInfo.stationNames[i]);
+    }
     Train train{index, trainDataFile.write(trainInfo)};
     unreleasedTrainMap.insert(train);
     return true;
@@ -283,9 +336,10 @@ namespace Trains {
     for (int i = 0; i < trainInfo->stationNum; i++) {
       stationMap.insert(Station{trainInfo->stationNames[i], train.trainData, i});
     }
-    trainInfo->seatLoc = Trains::seatDataFile.add(Seats(trainInfo->stationNum, trainInfo->seatNum));
-    for(int i = 1; i < trainInfo->totalCount; i++) {
-      Trains::seatDataFile.add(Seats(trainInfo->stationNum, trainInfo->seatNum));
+    trainInfo->seatLocs = vector<int>(trainInfo->totalCount);
+    for (int i = 0; i < trainInfo->totalCount; i++) {
+      trainInfo->seatLocs[i] =
+        Trains::seatDataFile.add(trainInfo->firstStartDate + i, Seats(trainInfo->stationNum, trainInfo->seatNum));
     }
     return true;
   }
@@ -304,25 +358,15 @@ namespace Trains {
     return {};
   }
 
-  void queryTicket(const String40 &from, const String40 &to, int date, bool isPrice) {
+  void queryTicket(const String40 &from, const String40 &to, int date, bool isPrice, Response &out) {
     auto it1 = stationMap.find({from, 0, 0});
     auto it2 = stationMap.find({to, 0, 0});
-    priority_queue<Line> queue(isPrice ? Line::cmpPrice : Line::cmpTime);
+    list<int> trains; //trainData of the trains which stop at from and later at to
+    list<pair<int, int>> stops; //the indices of from and to in them
     while (!it1.end() && it1->station == from && !it2.end() && it2->station == to) {
       if (it1->trainData == it2->trainData && it1->stationNum < it2->stationNum) {
-        TrainInfo *trainInfo = trainDataFile.get(it1->trainData, false);
-        int trainNum = trainInfo->findTrainNum(date, it1->stationNum);
-        if (trainNum >= 0 && trainNum < trainInfo->totalCount) {
-          Chrono departure = trainInfo->getDeparture(trainNum, it1->stationNum);
-          Chrono arrival = trainInfo->getArrival(trainNum, it2->stationNum);
-          int seat = trainInfo->getMaxSeat(trainNum, it1->stationNum, it2->stationNum);
-          queue.push(Line{trainInfo->trainID,
-                          from, departure,
-                          to, arrival,
-                          trainInfo->getPrice(it1->stationNum, it2->stationNum),
-                          seat,
-                          arrival.toTick() - departure.toTick()});
-        }
+        trains.push_back(it1->trainData);
+        stops.push_back({it1->stationNum, it2->stationNum});
       }
       if (it1->trainData < it2->trainData) {
         it1++;
@@ -330,10 +374,40 @@ namespace Trains {
         it2++;
       }
     }
-    std::cout << queue.size();
-    while (!queue.empty()) {
-      std::cout << '\n' << queue.top();
-      queue.pop();
+    //the trains, and then their seats on date, are read in one batch each instead of one by one
+    trainDataFile.fetch(trains);
+    list<int> trainNums;
+    list<pair<int, int>> seats; //start dates and indices
+    for (size_t i = 0; i < trains.size(); i++) {
+      TrainInfo *trainInfo = trainDataFile.get(trains[i], false);
+      int trainNum = trainInfo->findTrainNum(date, stops[i].first);
+      trainNums.push_back(trainNum >= 0 && trainNum < trainInfo->totalCount ? trainNum : -1);
+      if (trainNums.back() >= 0) {
+        seats.push_back({trainInfo->firstStartDate + trainNum, trainInfo->seatLocs[trainNum]});
+      }
+    }
+    seatDataFile.fetch(seats);
+    top_k<Line> ranking(isPrice ? Line::cmpPrice : Line::cmpTime); //every train is printed, so all are sorted
+    for (size_t i = 0; i < trains.size(); i++) {
+      if (trainNums[i] < 0) {
+        continue;
+      }
+      TrainInfo *trainInfo = trainDataFile.get(trains[i], false);
+      int trainNum = trainNums[i];
+      Chrono departure = trainInfo->getDeparture(trainNum, stops[i].first);
+      Chrono arrival = trainInfo->getArrival(trainNum, stops[i].second);
+      int seat = trainInfo->getMaxSeat(trainNum, stops[i].first, stops[i].second);
+      ranking.push(Line{trainInfo->trainID,
+                        from, departure,
+                        to, arrival,
+                        trainInfo->getPrice(stops[i].first, stops[i].second),
+                        seat,
+                        arrival.toTick() - departure.toTick()});
+    }
+    out.count(ranking.size());
+    const list<Line> &lines = ranking.sorted();
+    for (size_t i = 0; i < lines.size(); i++) {
+      out.line(lines[i]);
     }
   }
 
@@ -346,26 +420,36 @@ namespace Trains {
     auto operator<=>(const TrainStationInfo &rhs) const = default;
   };
 
-  bool queryTransfer(const String40 &from, const String40 &to, int date, bool isPrice) {
-    priority_queue<pair<Line, Line>> queue(isPrice ? Line::cmpPricePair : Line::cmpTimePair);
+  bool queryTransfer(const String40 &from, const String40 &to, int date, bool isPrice, Response &out) {
+    top_k<pair<Line, Line>, 1> best(isPrice ? Line::cmpPricePair : Line::cmpTimePair); //only the first is printed
     auto it1 = stationMap.find({from, 0, 0});
     auto it2 = stationMap.find({to, 0, 0});
-    set<TrainStationInfo> stationIndices;
+    set<TrainStationInfo, std::less<TrainStationInfo>, arena_allocator> stationIndices;
     list<TrainInfo *> trainFromList;
-    while (!it1.end() && it1->station == from) {
-      TrainInfo *trainFrom = trainDataFile.get(it1->trainData, false);
-      for (int intersectionIndexFrom = it1->stationNum + 1;
+    list<int> trainsFrom, stopsFrom, trainsTo, stopsTo; //trainData and station index of the trains at from and to
+    for (; !it1.end() && it1->station == from; it1++) {
+      trainsFrom.push_back(it1->trainData);
+      stopsFrom.push_back(it1->stationNum);
+    }
+    for (; !it2.end() && it2->station == to; it2++) {
+      trainsTo.push_back(it2->trainData);
+      stopsTo.push_back(it2->stationNum);
+    }
+    trainDataFile.fetch(trainsFrom); //in one batch each instead of one by one
+    trainDataFile.fetch(trainsTo);
+    for (size_t i = 0; i < trainsFrom.size(); i++) {
+      TrainInfo *trainFrom = trainDataFile.get(trainsFrom[i], false);
+      for (int intersectionIndexFrom = stopsFrom[i] + 1;
            intersectionIndexFrom < trainFrom->stationNum; intersectionIndexFrom++) {
         stationIndices.insert(
-          {trainFrom->stationNames[intersectionIndexFrom], (int) trainFromList.size(), it1->stationNum,
+          {trainFrom->stationNames[intersectionIndexFrom], (int) trainFromList.size(), stopsFrom[i],
            intersectionIndexFrom});
       }
       trainFromList.push_back(trainFrom);
-      it1++;
     }
-    while (!it2.end() && it2->station == to) {
-      TrainInfo *trainTo = trainDataFile.get(it2->trainData, false);
-      for (int intersectionIndexTo = 0; intersectionIndexTo < it2->stationNum; intersectionIndexTo++) {
+    for (size_t i = 0; i < trainsTo.size(); i++) {
+      TrainInfo *trainTo = trainDataFile.get(trainsTo[i], false);
+      for (int intersectionIndexTo = 0; intersectionIndexTo < stopsTo[i]; intersectionIndexTo++) {
         const String40 &intersection = trainTo->stationNames[intersectionIndexTo];
         auto range = stationIndices.lower_bound({intersection, 0, 0, 0});
         for (auto candidate = range;
@@ -376,7 +460,7 @@ namespace Trains {
           }
           int indexFrom = candidate->fromIndex;
           int intersectionIndexFrom = candidate->intersectionIndexFrom;
-          int indexTo = it2->stationNum;
+          int indexTo = stopsTo[i];
           int trainNumFrom = trainFrom->findTrainNum(date, indexFrom);
           if (trainNumFrom < 0 || trainNumFrom >= trainFrom->totalCount) {
             continue;
@@ -389,26 +473,26 @@ namespace Trains {
           }
           Chrono departureTo = trainTo->getDeparture(trainNumTo, intersectionIndexTo);
           Chrono arrivalTo = trainTo->getArrival(trainNumTo, indexTo);
-          queue.push({Line{trainFrom->trainID,
-                           from, departureFrom,
-                           intersection, arrivalFrom,
-                           trainFrom->getPrice(indexFrom, intersectionIndexFrom),
-                           trainFrom->getMaxSeat(trainNumFrom, indexFrom, intersectionIndexFrom),
-                           arrivalFrom.toTick() - departureFrom.toTick()},
-                      Line{trainTo->trainID,
-                           intersection, departureTo,
-                           to, arrivalTo,
-                           trainTo->getPrice(intersectionIndexTo, indexTo),
-                           trainTo->getMaxSeat(trainNumTo, intersectionIndexTo, indexTo),
-                           arrivalTo.toTick() - departureTo.toTick()}});
+          best.push({Line{trainFrom->trainID,
+                          from, departureFrom,
+                          intersection, arrivalFrom,
+                          trainFrom->getPrice(indexFrom, intersectionIndexFrom),
+                          trainFrom->getMaxSeat(trainNumFrom, indexFrom, intersectionIndexFrom),
+                          arrivalFrom.toTick() - departureFrom.toTick()},
+                     Line{trainTo->trainID,
+                          intersection, departureTo,
+                          to, arrivalTo,
+                          trainTo->getPrice(intersectionIndexTo, indexTo),
+                          trainTo->getMaxSeat(trainNumTo, intersectionIndexTo, indexTo),
+                          arrivalTo.toTick() - departureTo.toTick()}});
         }
       }
-      it2++;
     }
-    if (queue.empty()) {
+    if (best.empty()) {
       return false;
     }
-    std::cout << queue.top().first << '\n' << queue.top().second;
+    out.line(best.top().first);
+    out.line(best.top().second);
     return true;
   }
 }
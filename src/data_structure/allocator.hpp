@@ -0,0 +1,159 @@
+#ifndef TICKETSYSTEM2024_ALLOCATOR_HPP
+#define TICKETSYSTEM2024_ALLOCATOR_HPP
+
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include "list.hpp"
+
+//where the node-based containers (map, set, priority_queue) get their nodes from. an allocator makes and destroys
+//the nodes of one container. bulk is true if the memory goes all at once without the nodes being destroyed, so a
+//container whose nodes need no destructor may be dropped without walking them
+
+//new and delete, one node at a time
+struct heap_allocator {
+  static constexpr bool bulk = false;
+
+  template<typename N, typename... Args>
+  N *create(Args &&... args) {
+    return new N(std::forward<Args>(args)...);
+  }
+
+  template<typename N>
+  void destroy(N *p) {
+    delete p;
+  }
+};
+
+//memory got in blocks of many nodes, with the nodes destroyed kept on a free list for the next ones. for long-lived
+//containers which change all the time, like the caches, and for the cache frames themselves. the memory is given
+//back with the allocator
+class pool_allocator {
+  static constexpr size_t BLOCK = 1 << 16;
+  static constexpr size_t SLAB = 8; //nodes a block holds at least, for large nodes
+
+  void *freeList = nullptr;
+  list<char *> blocks;
+  char *cur = nullptr;
+  char *end = nullptr;
+
+public:
+  static constexpr bool bulk = false;
+
+  pool_allocator() = default;
+
+  pool_allocator(const pool_allocator &) : pool_allocator() {} //a copy of a container has nodes of its own
+
+  pool_allocator &operator=(const pool_allocator &) = delete;
+
+  ~pool_allocator() {
+    for (char *block: blocks) {
+      free(block);
+    }
+  }
+
+  template<typename N, typename... Args>
+  N *create(Args &&... args) {
+    static_assert(sizeof(N) >= sizeof(void *), "a node must hold the link of the free list");
+    constexpr size_t SIZE = (sizeof(N) + alignof(N) - 1) / alignof(N) * alignof(N);
+    void *p;
+    if (freeList) {
+      p = freeList;
+      freeList = *static_cast<void **>(p);
+    } else {
+      if ((size_t) (end - cur) < SIZE) {
+        size_t size = SIZE * SLAB > BLOCK ? SIZE * SLAB : BLOCK;
+        cur = static_cast<char *>(malloc(size)); //aligned for any node
+        end = cur + size;
+        blocks.push_back(cur);
+      }
+      p = cur;
+      cur += SIZE;
+    }
+    return new(p) N(std::forward<Args>(args)...);
+  }
+
+  template<typename N>
+  void destroy(N *p) {
+    p->~N();
+    *reinterpret_cast<void **>(p) = freeList;
+    freeList = p;
+  }
+};
+
+//memory handed out by a pointer bump and taken back all at once by reset. each thread has its own, which is reset
+//after every command, so that the scratch containers of a command cost no frees (see Commands)
+class arena {
+  static constexpr size_t BLOCK = 1 << 16;
+
+  list<char *> blocks; //kept over resets
+  list<char *> large; //allocations too large for a block, freed by reset
+  size_t block = 0; //the block being used
+  size_t used = 0; //bytes used in it
+
+  arena() = default;
+
+public:
+  arena(const arena &) = delete;
+
+  arena &operator=(const arena &) = delete;
+
+  ~arena() {
+    reset();
+    for (char *p: blocks) {
+      free(p);
+    }
+  }
+
+  static arena &local() {
+    thread_local arena instance;
+    return instance;
+  }
+
+  void *allocate(size_t size, size_t align) { //align is at most that of malloc
+    if (size > BLOCK) {
+      large.push_back(static_cast<char *>(malloc(size)));
+      return large.back();
+    }
+    size_t offset = (used + align - 1) & ~(align - 1);
+    if (block < blocks.size() && offset + size <= BLOCK) {
+      used = offset + size;
+      return blocks[block] + offset;
+    }
+    if (block < blocks.size()) {
+      block++;
+    }
+    if (block == blocks.size()) {
+      blocks.push_back(static_cast<char *>(malloc(BLOCK)));
+    }
+    used = size;
+    return blocks[block];
+  }
+
+  //take back everything handed out. nothing allocated before may be used any more
+  void reset() {
+    for (char *p: large) {
+      free(p);
+    }
+    large.clear();
+    block = 0;
+    used = 0;
+  }
+};
+
+//nodes from the arena of the thread, for containers which live within one command on one thread
+struct arena_allocator {
+  static constexpr bool bulk = true;
+
+  template<typename N, typename... Args>
+  N *create(Args &&... args) {
+    return new(arena::local().allocate(sizeof(N), alignof(N))) N(std::forward<Args>(args)...);
+  }
+
+  template<typename N>
+  void destroy(N *p) {
+    p->~N();
+  }
+};
+
+#endif
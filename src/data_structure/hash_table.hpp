@@ -0,0 +1,143 @@
+#ifndef TICKETSYSTEM2024_HASH_TABLE_HPP
+#define TICKETSYSTEM2024_HASH_TABLE_HPP
+
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include "../util/Hash.hpp"
+
+//an in-memory hash table of T keyed by T::index, with open addressing in one flat array. a slot keeps the hash of its
+//key, so that probes compare keys only on a full hash match and growing never hashes again. the table doubles when
+//it is 3/4 full, and an erase moves the later records of its run back instead of leaving a tombstone, so lookups
+//stay short however many records come and go. T is copied as bytes, and pointers to records last until the next
+//insert
+template<typename T>
+class hash_table {
+  typedef T::INDEX INDEX;
+
+  static_assert(std::is_trivially_copyable_v<T>, "records are moved as bytes");
+
+  static constexpr size_t MIN_CAPACITY = 16;
+
+  struct Slot {
+    unsigned long long hash; //0 if the slot is empty
+    T value;
+  };
+
+  Slot *slots = nullptr;
+  size_t mask = 0; //capacity - 1
+  size_t count = 0;
+
+  static unsigned long long hashIndex(const INDEX &index) {
+    unsigned long long hash = hashOf(index);
+    return hash ? hash : 1;
+  }
+
+  void allocate(size_t capacity) {
+    slots = static_cast<Slot *>(calloc(capacity, sizeof(Slot)));
+    mask = capacity - 1;
+  }
+
+  //the slot holding index, or the empty one ending its run
+  size_t probe(const INDEX &index, unsigned long long hash) const {
+    size_t i = hash & mask;
+    while (slots[i].hash && (slots[i].hash != hash || !(slots[i].value.index() == index))) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  void grow() {
+    Slot *old = slots;
+    size_t oldCapacity = mask + 1;
+    allocate(oldCapacity * 2);
+    for (size_t i = 0; i < oldCapacity; i++) {
+      if (old[i].hash) {
+        size_t j = old[i].hash & mask;
+        while (slots[j].hash) {
+          j = (j + 1) & mask;
+        }
+        memcpy(&slots[j], &old[i], sizeof(Slot));
+      }
+    }
+    free(old);
+  }
+
+public:
+  hash_table() {
+    allocate(MIN_CAPACITY);
+  }
+
+  hash_table(const hash_table &) = delete;
+
+  hash_table &operator=(const hash_table &) = delete;
+
+  ~hash_table() {
+    free(slots);
+  }
+
+  T *find(const INDEX &index) {
+    size_t i = probe(index, hashIndex(index));
+    return slots[i].hash ? &slots[i].value : nullptr;
+  }
+
+  //return false if a record with the same index is in the table
+  bool insert(const T &value) {
+    if ((count + 1) * 4 > (mask + 1) * 3) {
+      grow();
+    }
+    unsigned long long hash = hashIndex(value.index());
+    size_t i = probe(value.index(), hash);
+    if (slots[i].hash) {
+      return false;
+    }
+    slots[i].hash = hash;
+    memcpy(&slots[i].value, &value, sizeof(T));
+    count++;
+    return true;
+  }
+
+  bool erase(const INDEX &index) {
+    size_t i = probe(index, hashIndex(index));
+    if (!slots[i].hash) {
+      return false;
+    }
+    //move back each later record of the run whose home is not between the hole and itself
+    for (size_t j = (i + 1) & mask; slots[j].hash; j = (j + 1) & mask) {
+      size_t home = slots[j].hash & mask;
+      if (i <= j ? home <= i || home > j : home <= i && home > j) {
+        memcpy(&slots[i], &slots[j], sizeof(Slot));
+        i = j;
+      }
+    }
+    slots[i].hash = 0;
+    count--;
+    return true;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  bool empty() const {
+    return count == 0;
+  }
+
+  //call f on every record, in no particular order. f may not insert or erase
+  template<typename F>
+  void forEach(F f) {
+    for (size_t i = 0; i <= mask; i++) {
+      if (slots[i].hash) {
+        f(slots[i].value);
+      }
+    }
+  }
+
+  void clear() {
+    free(slots);
+    allocate(MIN_CAPACITY);
+    count = 0;
+  }
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef TICKETSYSTEM2024_LIST_HPP
 #define TICKETSYSTEM2024_LIST_HPP
 
+#include <cstring>
 #include "../util/Exceptions.hpp"
 
 template<typename T>
@@ -1,10 +1,12 @@
 #ifndef TICKETSYSTEM2024_MAP_HPP
 #define TICKETSYSTEM2024_MAP_HPP
 
+#include <type_traits>
 #include "../util/Exceptions.hpp"
+#include "allocator.hpp"
 #include "pair.hpp"
 
-template<class Key, class T, class Compare = std::less<Key>>
+template<class Key, class T, class Compare = std::less<Key>, class Alloc = heap_allocator>
 class map {
 public:
   using value_type = pair<const Key, T>;
@@ -279,33 +281,34 @@ private:
         replaceWith(nullptr);
       }
     }
-
-    //clear self and its children
-    void clear() {
-      if (left) {
-        left->clear();
-      }
-      if (right) {
-        right->clear();
-      }
-      delete this;
-    }
-
-    //copy self and its children
-    Node *copy() {
-      Node *newNode = new Node(*this);
-      if (left) {
-        newNode->setLeft(left->copy());
-      }
-      if (right) {
-        newNode->setRight(right->copy());
-      }
-      return newNode;
-    }
   };
 
   Node *dummy;
   int length;
+  [[no_unique_address]] Alloc alloc;
+
+  //clear p and its children
+  void clear(Node *p) {
+    if (p->left) {
+      clear(p->left);
+    }
+    if (p->right) {
+      clear(p->right);
+    }
+    alloc.destroy(p);
+  }
+
+  //copy p and its children
+  Node *copy(const Node *p) {
+    Node *newNode = alloc.template create<Node>(*p);
+    if (p->left) {
+      newNode->setLeft(copy(p->left));
+    }
+    if (p->right) {
+      newNode->setRight(copy(p->right));
+    }
+    return newNode;
+  }
 
   Node *root() const {
     return dummy->left;
@@ -495,7 +498,7 @@ public:
 
   map(const map &other) : map() {
     if (other.root()) {
-      dummy->setLeft(other.root()->copy());
+      dummy->setLeft(copy(other.root()));
     }
     length = other.length;
   }
@@ -509,8 +512,8 @@ public:
   }
 
   ~map() {
-    if (root()) {
-      root()->clear();
+    if (root() && !(Alloc::bulk && std::is_trivially_destructible_v<value_type>)) { //else the nodes just go
+      clear(root());
     }
     free(dummy);
   }
@@ -581,7 +584,7 @@ public:
 
   pair<iterator, bool> insert(const value_type &value) {
     if (!root()) {
-      Node *newNode = new Node(value);
+      Node *newNode = alloc.template create<Node>(value);
       dummy->setLeft(newNode);
       newNode->checkInsert();
       length++;
@@ -591,7 +594,7 @@ public:
     while (true) {
       if (Compare()(value.first, cur->key())) {
         if (!cur->left) {
-          Node *newNode = new Node(value);
+          Node *newNode = alloc.template create<Node>(value);
           cur->setLeft(newNode);
           newNode->checkInsert();
           length++;
@@ -600,7 +603,7 @@ public:
         cur = cur->left;
       } else if (Compare()(cur->key(), value.first)) {
         if (!cur->right) {
-          Node *newNode = new Node(value);
+          Node *newNode = alloc.template create<Node>(value);
           cur->setRight(newNode);
           newNode->checkInsert();
           length++;
@@ -630,7 +633,7 @@ public:
       cur->balanceAndErase();
     }
     length--;
-    delete cur;
+    alloc.destroy(cur);
   }
 
   size_t count(const Key &key) const {
@@ -1,9 +1,11 @@
 #ifndef TICKETSYSTEM2024_PRIORITY_QUEUE_HPP
 #define TICKETSYSTEM2024_PRIORITY_QUEUE_HPP
 
+#include <type_traits>
 #include "../util/Exceptions.hpp"
+#include "allocator.hpp"
 
-template<typename T>
+template<typename T, class Alloc = heap_allocator>
 class priority_queue {
   static bool defaultCmp(const T &a, const T &b) {
     return a < b;
@@ -16,21 +18,32 @@ class priority_queue {
     Node *child, *sibling;
 
     explicit Node(const T &v) : value(v), child(nullptr), sibling(nullptr) {}
+  };
 
-    Node(const Node &other) : value(other.value), child(nullptr), sibling(nullptr) {
-      if (other.child) {
-        child = new Node(*other.child);
-      }
-      if (other.sibling) {
-        sibling = new Node(*other.sibling);
+  [[no_unique_address]] Alloc alloc;
+
+  //destroy n with its children and the siblings after it
+  void clear(Node *n) {
+    while (n) {
+      if (n->child) {
+        clear(n->child);
       }
+      Node *sibling = n->sibling;
+      alloc.destroy(n);
+      n = sibling;
     }
+  }
 
-    ~Node() {
-      delete child;
-      delete sibling;
+  Node *copy(const Node *n) {
+    Node *ret = alloc.template create<Node>(n->value);
+    if (n->child) {
+      ret->child = copy(n->child);
     }
-  };
+    if (n->sibling) {
+      ret->sibling = copy(n->sibling);
+    }
+    return ret;
+  }
 
   Node *mergeNode(Node *a, Node *b) { // merge two roots and return the new root, a and b will be invalid
     if (!a) {
@@ -81,12 +94,14 @@ public:
 
   priority_queue(const priority_queue &other) : root(nullptr), length(other.length), compare(other.compare) {
     if (other.root) {
-      root = new Node(*other.root);
+      root = copy(other.root);
     }
   }
 
   ~priority_queue() {
-    delete root;
+    if (!(Alloc::bulk && std::is_trivially_destructible_v<T>)) { //else the nodes just go
+      clear(root);
+    }
   }
 
   priority_queue &operator=(const priority_queue &other) {
@@ -105,11 +120,11 @@ public:
   }
 
   void push(const T &v) {
-    Node *newNode = new Node(v);
+    Node *newNode = alloc.template create<Node>(v);
     try {
       root = mergeNode(root, newNode);
     } catch (...) {
-      delete newNode;
+      alloc.destroy(newNode);
       throw;
     }
     length++;
@@ -122,8 +137,7 @@ public:
     compress(root->child);
     Node *old = root;
     root = root->child;
-    old->child = nullptr;
-    delete old;
+    alloc.destroy(old);
     length--;
   }
 
@@ -136,6 +150,7 @@ public:
   }
 
   void merge(priority_queue &other) {
+    static_assert(std::is_empty_v<Alloc>, "nodes only move between queues whose allocator holds no memory");
     root = mergeNode(root, other.root);
     other.root = nullptr;
     other.length = 0;
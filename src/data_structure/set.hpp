@@ -1,10 +1,12 @@
 #ifndef TICKETSYSTEM2024_SET_HPP
 #define TICKETSYSTEM2024_SET_HPP
 
+#include <type_traits>
 #include "../util/Exceptions.hpp"
+#include "allocator.hpp"
 #include "pair.hpp"
 
-template<class T, class Compare = std::less<T>>
+template<class T, class Compare = std::less<T>, class Alloc = heap_allocator>
 class set {
 public:
   using value_type = T;
@@ -271,33 +273,34 @@ private:
         replaceWith(nullptr);
       }
     }
-
-    //clear self and its children
-    void clear() {
-      if (left) {
-        left->clear();
-      }
-      if (right) {
-        right->clear();
-      }
-      delete this;
-    }
-
-    //copy self and its children
-    Node *copy() {
-      Node *newNode = new Node(*this);
-      if (left) {
-        newNode->setLeft(left->copy());
-      }
-      if (right) {
-        newNode->setRight(right->copy());
-      }
-      return newNode;
-    }
   };
 
   Node *dummy;
   int length;
+  [[no_unique_address]] Alloc alloc;
+
+  //clear p and its children
+  void clear(Node *p) {
+    if (p->left) {
+      clear(p->left);
+    }
+    if (p->right) {
+      clear(p->right);
+    }
+    alloc.destroy(p);
+  }
+
+  //copy p and its children
+  Node *copy(const Node *p) {
+    Node *newNode = alloc.template create<Node>(*p);
+    if (p->left) {
+      newNode->setLeft(copy(p->left));
+    }
+    if (p->right) {
+      newNode->setRight(copy(p->right));
+    }
+    return newNode;
+  }
 
   Node *root() const {
     return dummy->left;
@@ -486,7 +489,7 @@ public:
 
   set(const set &other) : set() {
     if (other.root()) {
-      dummy->setLeft(other.root()->copy());
+      dummy->setLeft(copy(other.root()));
     }
     length = other.length;
   }
@@ -500,8 +503,8 @@ public:
   }
 
   ~set() {
-    if (root()) {
-      root()->clear();
+    if (root() && !(Alloc::bulk && std::is_trivially_destructible_v<value_type>)) { //else the nodes just go
+      clear(root());
     }
     free(dummy);
   }
@@ -536,7 +539,7 @@ public:
 
   pair<iterator, bool> insert(const value_type &value) {
     if (!root()) {
-      Node *newNode = new Node(value);
+      Node *newNode = alloc.template create<Node>(value);
       dummy->setLeft(newNode);
       newNode->checkInsert();
       length++;
@@ -546,7 +549,7 @@ public:
     while (true) {
       if (Compare()(value, cur->data)) {
         if (!cur->left) {
-          Node *newNode = new Node(value);
+          Node *newNode = alloc.template create<Node>(value);
           cur->setLeft(newNode);
           newNode->checkInsert();
           length++;
@@ -555,7 +558,7 @@ public:
         cur = cur->left;
       } else if (Compare()(cur->data, value)) {
         if (!cur->right) {
-          Node *newNode = new Node(value);
+          Node *newNode = alloc.template create<Node>(value);
           cur->setRight(newNode);
           newNode->checkInsert();
           length++;
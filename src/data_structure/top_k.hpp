@@ -0,0 +1,212 @@
+#ifndef TICKETSYSTEM2024_TOP_K_HPP
+#define TICKETSYSTEM2024_TOP_K_HPP
+
+#include <bit>
+#include <utility>
+#include "list.hpp"
+
+//the first K values in rank order out of any number pushed, kept in one flat buffer. after(a, b) is true if a ranks
+//after b, like the compare of priority_queue. K = 0 keeps them all and sorts them once at the end (introsort). a
+//larger K keeps the K first so far in a 4-ary heap with the last of them on top, so that a value which ranks after
+//it is dropped with one comparison. K = 1 keeps just the first and has no buffer
+template<typename T, int K = 0>
+class top_k {
+  static constexpr size_t D = 4; //children of a heap node: the 4 are on one or two cache lines for small T
+  static constexpr size_t INSERTION = 16; //ranges no longer than this are sorted by insertion
+
+  using Compare = bool (*)(const T &, const T &);
+
+  Compare after;
+  list<T> values;
+
+  T *data() {
+    return &values[0];
+  }
+
+  //restore the heap of the n values a[0, n) below i, which are heaps but for a[i]. the value ranked last is on top
+  void siftDown(T *a, size_t n, size_t i) {
+    T value = std::move(a[i]);
+    while (true) {
+      size_t first = i * D + 1;
+      if (first >= n) {
+        break;
+      }
+      size_t last = first + D < n ? first + D : n;
+      size_t child = first;
+      for (size_t j = first + 1; j < last; j++) {
+        if (after(a[j], a[child])) {
+          child = j;
+        }
+      }
+      if (!after(a[child], value)) {
+        break;
+      }
+      a[i] = std::move(a[child]);
+      i = child;
+    }
+    a[i] = std::move(value);
+  }
+
+  void siftUp(T *a, size_t i) {
+    T value = std::move(a[i]);
+    while (i > 0) {
+      size_t parent = (i - 1) / D;
+      if (!after(value, a[parent])) {
+        break;
+      }
+      a[i] = std::move(a[parent]);
+      i = parent;
+    }
+    a[i] = std::move(value);
+  }
+
+  //sort a heap in place by moving its top to the back n times
+  void sortHeap(T *a, size_t n) {
+    for (size_t end = n; end > 1; end--) {
+      std::swap(a[0], a[end - 1]);
+      siftDown(a, end - 1, 0);
+    }
+  }
+
+  void heapSort(T *a, size_t n) {
+    if (n < 2) {
+      return;
+    }
+    for (size_t i = (n - 2) / D + 1; i-- > 0;) {
+      siftDown(a, n, i);
+    }
+    sortHeap(a, n);
+  }
+
+  void insertionSort(T *a, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+      T value = std::move(a[i]);
+      size_t j = i;
+      for (; j > 0 && after(a[j - 1], value); j--) {
+        a[j] = std::move(a[j - 1]);
+      }
+      a[j] = std::move(value);
+    }
+  }
+
+  //quicksort on the median of three, recursing into the smaller part only, which turns to heapsort once depth runs
+  //out so that no input takes quadratic time
+  void introSort(T *a, size_t n, int depth) {
+    while (n > INSERTION) {
+      if (depth-- == 0) {
+        heapSort(a, n);
+        return;
+      }
+      size_t mid = n / 2;
+      if (after(a[0], a[mid])) {
+        std::swap(a[0], a[mid]);
+      }
+      if (after(a[mid], a[n - 1])) {
+        std::swap(a[mid], a[n - 1]);
+      }
+      if (after(a[0], a[mid])) {
+        std::swap(a[0], a[mid]);
+      }
+      std::swap(a[0], a[mid]); //the pivot goes first, and a[n - 1] stops the scan from the left
+      size_t i = 0;
+      size_t j = n;
+      while (true) {
+        do {
+          i++;
+        } while (after(a[0], a[i]));
+        do {
+          j--;
+        } while (after(a[j], a[0]));
+        if (i >= j) {
+          break;
+        }
+        std::swap(a[i], a[j]);
+      }
+      std::swap(a[0], a[j]);
+      if (j < n - j - 1) {
+        introSort(a, j, depth);
+        a += j + 1;
+        n -= j + 1;
+      } else {
+        introSort(a + j + 1, n - j - 1, depth);
+        n = j;
+      }
+    }
+    insertionSort(a, n);
+  }
+
+public:
+  explicit top_k(Compare after) : after(after) {}
+
+  void push(const T &value) {
+    if (K == 0 || values.size() < (size_t) K) {
+      values.push_back(value);
+      if (K != 0) {
+        siftUp(data(), values.size() - 1);
+      }
+      return;
+    }
+    T *a = data();
+    if (after(a[0], value)) {
+      a[0] = value;
+      siftDown(a, K, 0);
+    }
+  }
+
+  size_t size() const {
+    return values.size();
+  }
+
+  bool empty() const {
+    return values.empty();
+  }
+
+  //the values kept, first ranked first. nothing may be pushed after
+  const list<T> &sorted() {
+    size_t n = values.size();
+    if (n > 1) {
+      if (K == 0) {
+        introSort(data(), n, 2 * std::bit_width(n));
+      } else {
+        sortHeap(data(), n);
+      }
+    }
+    return values;
+  }
+};
+
+template<typename T>
+class top_k<T, 1> {
+  using Compare = bool (*)(const T &, const T &);
+
+  Compare after;
+  T first;
+  bool present = false;
+
+public:
+  explicit top_k(Compare after) : after(after), first() {}
+
+  void push(const T &value) {
+    if (!present || after(first, value)) {
+      first = value;
+      present = true;
+    }
+  }
+
+  size_t size() const {
+    return present;
+  }
+
+  bool empty() const {
+    return !present;
+  }
+
+  const T &top() const {
+    if (!present) {
+      throw ContainerEmpty();
+    }
+    return first;
+  }
+};
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef TICKETSYSTEM2024_COUNTING_BLOOM_FILTER_HPP
+#define TICKETSYSTEM2024_COUNTING_BLOOM_FILTER_HPP
+
+#include <cstring>
+#include "File.hpp"
+
+//bloom filter with 4-bit counters instead of bits, so that keys can be removed. kept in memory and written back
+//whole by save. a counter which reaches 15 stays there, since it no longer knows how many keys it counts.
+//callers pass a hash of the key, which is spread over HASH_COUNT counters by double hashing
+template<int LOG_SIZE>
+class CountingBloomFilter {
+  static constexpr int SIZE = 1 << LOG_SIZE; //the number of counters
+  static constexpr int BYTES = SIZE / 2;
+  static constexpr int HASH_COUNT = 4;
+  static constexpr unsigned char MAX_COUNT = 15;
+
+  File file;
+  unsigned char *counters = new unsigned char[BYTES]{};
+  bool dirty = false;
+
+  static int position(unsigned long long hash, int i) {
+    unsigned long long step = (hash >> 32) | 1;
+    return (int) ((hash + i * step) & (SIZE - 1));
+  }
+
+  unsigned char get(int p) const {
+    return p & 1 ? counters[p >> 1] >> 4 : counters[p >> 1] & 15;
+  }
+
+  void set(int p, unsigned char count) {
+    counters[p >> 1] = p & 1 ? (counters[p >> 1] & 15) | count << 4 : (counters[p >> 1] & 0xf0) | count;
+  }
+
+public:
+  explicit CountingBloomFilter(const std::string &file_name) : file(file_name) {}
+
+  CountingBloomFilter(const CountingBloomFilter &) = delete;
+
+  CountingBloomFilter &operator=(const CountingBloomFilter &) = delete;
+
+  ~CountingBloomFilter() {
+    save();
+    delete[] counters;
+  }
+
+  //read the counters from file. return false if the file does not hold a filter of this size, which is then empty
+  bool load() {
+    dirty = false;
+    if (file.size() != BYTES) {
+      memset(counters, 0, BYTES);
+      return false;
+    }
+    file.read(0, counters, BYTES);
+    return true;
+  }
+
+  void save() {
+    if (dirty) {
+      file.write(0, counters, BYTES);
+      dirty = false;
+    }
+  }
+
+  void add(unsigned long long hash) {
+    for (int i = 0; i < HASH_COUNT; i++) {
+      int p = position(hash, i);
+      if (get(p) < MAX_COUNT) {
+        set(p, get(p) + 1);
+      }
+    }
+    dirty = true;
+  }
+
+  void remove(unsigned long long hash) { //hash must have been added
+    for (int i = 0; i < HASH_COUNT; i++) {
+      int p = position(hash, i);
+      if (get(p) < MAX_COUNT) {
+        set(p, get(p) - 1);
+      }
+    }
+    dirty = true;
+  }
+
+  //false means the key has definitely not been added
+  bool mayContain(unsigned long long hash) const {
+    for (int i = 0; i < HASH_COUNT; i++) {
+      if (get(position(hash, i)) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef TICKETSYSTEM2024_DATED_STORAGE_HPP
+#define TICKETSYSTEM2024_DATED_STORAGE_HPP
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include "File.hpp"
+#include "FileStorage.hpp"
+#include "NamedSnapshots.hpp"
+#include "../util/Crc32c.hpp"
+#include "../util/Lz.hpp"
+#include "../util/Snapshot.hpp"
+#include "../util/Util.hpp"
+
+//records partitioned by date into a file each, so that the days still on sale are apart from the days gone, and a
+//record is known by its date and its index within the date. a day gone may be frozen: its records are compressed in
+//blocks into a read-only file, whose blocks are decompressed when read and dropped between commands. a write to a
+//frozen day thaws it back into a plain file first.
+//get may run in many threads alongside one thread which changes the storage, like in FileStorage
+template<class T, int DATES>
+class DatedStorage {
+  typedef FileStorage<T, int, 0> Hot;
+
+  //a frozen day. layout: the number of records and of blocks, then the offset, compressed size and crc32c of the
+  //compressed bytes of each block, then the blocks of BLOCK records each
+  class Cold {
+    static constexpr int BLOCK = 256; //records
+    static constexpr int BLOCK_BYTES = BLOCK * sizeof(T);
+    static constexpr int HEADER_SIZE = 2 * sizeof(int);
+
+    struct Block {
+      long long loc;
+      int size;
+      unsigned checksum;
+    };
+
+    File file;
+    int count = 0;
+    int blockCount = 0;
+    Block *blocks = nullptr;
+    std::atomic<T *> *decoded = nullptr; //the blocks decompressed since the last drop
+    std::mutex latch; //guards decompressing and file
+
+    //decompress block b into rows. false if it is corrupt, which leaves rows zeroed
+    bool decode(int b, T *rows) {
+      char *packed = new char[blocks[b].size];
+      file.read(blocks[b].loc, packed, blocks[b].size);
+      int size = b + 1 < blockCount ? BLOCK_BYTES : (count - b * BLOCK) * (int) sizeof(T);
+      bool intact = crc32c(packed, blocks[b].size) == blocks[b].checksum &&
+                    lzDecompress(packed, blocks[b].size, rows, BLOCK_BYTES) == size;
+      delete[] packed;
+      if (!intact) {
+        memset(static_cast<void *>(rows), 0, BLOCK_BYTES);
+      }
+      return intact;
+    }
+
+  public:
+    explicit Cold(const string &file_name) : file(file_name) {
+      file.read(0, &count, sizeof(int));
+      file.read(sizeof(int), &blockCount, sizeof(int));
+      if (count < 0 || blockCount != (count + BLOCK - 1) / BLOCK) {
+        file.stats.corrupt++;
+        count = blockCount = 0;
+      }
+      blocks = new Block[blockCount];
+      file.read(HEADER_SIZE, blocks, blockCount * (int) sizeof(Block));
+      decoded = new std::atomic<T *>[blockCount]();
+    }
+
+    Cold(const Cold &) = delete;
+
+    Cold &operator=(const Cold &) = delete;
+
+    ~Cold() {
+      drop();
+      delete[] decoded;
+      delete[] blocks;
+    }
+
+    //write the count records of hot into the file at file_name as a frozen day, in place of what it held
+    static void freeze(const string &file_name, Hot &hot, int count) {
+      int blockCount = (count + BLOCK - 1) / BLOCK;
+      File fresh(file_name + "_new");
+      fresh.truncate(0);
+      Block *blocks = new Block[blockCount];
+      T *rows = new T[BLOCK];
+      char *packed = new char[lzBound(BLOCK_BYTES)];
+      long long loc = HEADER_SIZE + blockCount * (long long) sizeof(Block);
+      list<int> indices;
+      for (int b = 0; b < blockCount; b++) {
+        int n = std::min(BLOCK, count - b * BLOCK);
+        indices.clear();
+        for (int i = 0; i < n; i++) {
+          indices.push_back(b * BLOCK + i);
+        }
+        hot.fetch(indices);
+        for (int i = 0; i < n; i++) {
+          rows[i] = *hot.get(b * BLOCK + i, false);
+        }
+        int size = lzCompress(rows, n * (int) sizeof(T), packed);
+        fresh.write(loc, packed, size);
+        blocks[b] = {loc, size, crc32c(packed, size)};
+        loc += size;
+      }
+      fresh.write(0, &count, sizeof(int));
+      fresh.write(sizeof(int), &blockCount, sizeof(int));
+      fresh.write(HEADER_SIZE, blocks, blockCount * (int) sizeof(Block));
+      File(file_name).replace(fresh);
+      delete[] packed;
+      delete[] rows;
+      delete[] blocks;
+    }
+
+    int size() const {
+      return count;
+    }
+
+    //may run in many threads alongside one another
+    T *get(int index) {
+      int b = index / BLOCK;
+      T *rows = decoded[b].load(std::memory_order_acquire);
+      if (rows) {
+        std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+        return rows + index % BLOCK;
+      }
+      std::lock_guard guard(latch);
+      rows = decoded[b].load(std::memory_order_relaxed);
+      if (!rows) {
+        rows = new T[BLOCK];
+        file.stats.misses++;
+        if (!decode(b, rows)) {
+          file.stats.corrupt++;
+        }
+        decoded[b].store(rows, std::memory_order_release);
+      }
+      return rows + index % BLOCK;
+    }
+
+    //free the decompressed blocks. no reader may be running
+    void drop() {
+      for (int b = 0; b < blockCount; b++) {
+        delete[] decoded[b].exchange(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    //check every block against its checksum. return the number of records in bad ones
+    int scrub() {
+      std::lock_guard guard(latch);
+      T *rows = new T[BLOCK];
+      int bad = 0;
+      for (int b = 0; b < blockCount; b++) {
+        if (!decode(b, rows)) {
+          file.stats.corrupt++;
+          bad += std::min(BLOCK, count - b * BLOCK);
+        }
+      }
+      delete[] rows;
+      return bad;
+    }
+
+    void remove() {
+      file.remove();
+    }
+  };
+
+  //the cold file stays in place after a thaw, until no reader may be reading it
+  struct Partition {
+    std::atomic<Hot *> hot{nullptr};
+    std::atomic<Cold *> cold{nullptr};
+  };
+
+  string name;
+  Partition partitions[DATES];
+
+  string hotName(int date) const {
+    return name + "_" + toStringInt(date);
+  }
+
+  string coldName(int date) const {
+    return hotName(date) + "_cold";
+  }
+
+  static bool exists(const string &file_name) {
+    return std::filesystem::exists(File::pathOf(file_name));
+  }
+
+  //a day whose plain file has no records is taken to be frozen if it has a cold file, since a file made by a thaw
+  //after a named snapshot was taken is emptied when the snapshot is restored
+  void open() {
+    for (int d = 0; d < DATES; d++) {
+      Hot *hot = exists(hotName(d)) ? new Hot(0, hotName(d)) : nullptr;
+      bool frozen = exists(coldName(d));
+      if (hot && hot->slots() == 0 && frozen) {
+        hot->unlink();
+        delete hot;
+        hot = nullptr;
+      }
+      partitions[d].hot.store(hot, std::memory_order_relaxed);
+      partitions[d].cold.store(!hot && frozen ? new Cold(coldName(d)) : nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  void close() {
+    for (int d = 0; d < DATES; d++) {
+      delete partitions[d].hot.exchange(nullptr, std::memory_order_relaxed);
+      delete partitions[d].cold.exchange(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  //the plain storage of a day, made or thawed if there is none. in the writer thread
+  Hot *writable(int date) {
+    Partition &partition = partitions[date];
+    Hot *hot = partition.hot.load(std::memory_order_relaxed);
+    if (hot) {
+      return hot;
+    }
+    hot = new Hot(0, hotName(date));
+    Cold *cold = partition.cold.load(std::memory_order_relaxed);
+    for (int i = 0; cold && i < cold->size(); i++) {
+      hot->add(*cold->get(i));
+    }
+    partition.hot.store(hot, std::memory_order_release);
+    return hot;
+  }
+
+public:
+  explicit DatedStorage(const string &file_name) : name(file_name) {
+    open();
+  }
+
+  DatedStorage(const DatedStorage &) = delete;
+
+  DatedStorage &operator=(const DatedStorage &) = delete;
+
+  ~DatedStorage() {
+    close();
+  }
+
+  //a snapshot reader gets the image of the record as of its epoch. a dirty get of a frozen day thaws it
+  T *get(int date, int index, bool dirty) {
+    Partition &partition = partitions[date];
+    if (dirty) {
+      return writable(date)->get(index, true);
+    }
+    Hot *hot = partition.hot.load(std::memory_order_acquire);
+    if (hot) {
+      return hot->get(index, false);
+    }
+    Cold *cold = partition.cold.load(std::memory_order_acquire);
+    return cold->get(index);
+  }
+
+  //in the writer thread. return the index of the record within its date
+  int add(int date, const T &t) {
+    return writable(date)->add(t);
+  }
+
+  //load the records at the given dates and indices with a batch of reads per date. the records of a frozen day are
+  //decompressed as they are read instead
+  void fetch(const list<pair<int, int>> &records) {
+    list<int> dates; //a query reads few of them
+    for (size_t i = 0; i < records.size(); i++) {
+      bool seen = false;
+      for (size_t j = 0; j < dates.size() && !seen; j++) {
+        seen = dates[j] == records[i].first;
+      }
+      if (!seen) {
+        dates.push_back(records[i].first);
+      }
+    }
+    list<int> indices;
+    for (int date: dates) {
+      Hot *hot = partitions[date].hot.load(std::memory_order_acquire);
+      if (!hot) {
+        continue;
+      }
+      indices.clear();
+      for (size_t i = 0; i < records.size(); i++) {
+        if (records[i].first == date) {
+          indices.push_back(records[i].second);
+        }
+      }
+      hot->fetch(indices);
+    }
+  }
+
+  //the cold files of thawed days are only closed, and their decompressed blocks only dropped, when no snapshot reader
+  //may be reading them
+  void checkCache() {
+    bool quiet = !Snapshot::active();
+    for (int d = 0; d < DATES; d++) {
+      Partition &partition = partitions[d];
+      Hot *hot = partition.hot.load(std::memory_order_relaxed);
+      Cold *cold = partition.cold.load(std::memory_order_relaxed);
+      if (hot) {
+        hot->checkCache();
+      }
+      if (!quiet || !cold) {
+        continue;
+      }
+      if (!hot) {
+        cold->drop();
+      } else {
+        if (NamedSnapshots::names.empty()) { //otherwise restoring one may need it
+          cold->remove();
+        }
+        partition.cold.store(nullptr, std::memory_order_relaxed);
+        delete cold;
+      }
+    }
+  }
+
+  void checkpoint() {
+    for (int d = 0; d < DATES; d++) {
+      Hot *hot = partitions[d].hot.load(std::memory_order_relaxed);
+      if (hot) {
+        hot->checkpoint();
+      }
+    }
+  }
+
+  //open every day again, after the files have changed underneath. no reader may be running. the plain storages are
+  //discarded, since writing back their headers would undo the change
+  void reload() {
+    for (int d = 0; d < DATES; d++) {
+      Hot *hot = partitions[d].hot.load(std::memory_order_relaxed);
+      if (hot) {
+        hot->discard();
+      }
+    }
+    close();
+    open();
+  }
+
+  //check every record against its checksum. the frames must have been written back. return the bad ones
+  int scrub() {
+    int bad = 0;
+    for (int d = 0; d < DATES; d++) {
+      Hot *hot = partitions[d].hot.load(std::memory_order_relaxed);
+      Cold *cold = partitions[d].cold.load(std::memory_order_relaxed);
+      bad += hot ? hot->scrub() : cold ? cold->scrub() : 0;
+    }
+    return bad;
+  }
+
+  //freeze every day before date which is not frozen. no reader may be running, and there may be no named snapshot,
+  //since the plain files are deleted. return the number of days frozen
+  int freeze(int date) {
+    int frozen = 0;
+    for (int d = 0; d < date && d < DATES; d++) {
+      Partition &partition = partitions[d];
+      Hot *hot = partition.hot.load(std::memory_order_relaxed);
+      if (!hot) {
+        continue;
+      }
+      delete partition.cold.exchange(nullptr, std::memory_order_relaxed); //left by a thaw
+      hot->checkpoint();
+      int count = hot->slots();
+      if (count > 0) {
+        Cold::freeze(coldName(d), *hot, count);
+        partition.cold.store(new Cold(coldName(d)), std::memory_order_relaxed);
+      } else if (exists(coldName(d))) {
+        std::filesystem::remove(File::pathOf(coldName(d)));
+      }
+      hot->unlink();
+      delete hot;
+      partition.hot.store(nullptr, std::memory_order_relaxed);
+      frozen++;
+    }
+    return frozen;
+  }
+};
+
+#endif
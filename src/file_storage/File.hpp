@@ -0,0 +1,200 @@
+#ifndef TICKETSYSTEM2024_FILE_HPP
+#define TICKETSYSTEM2024_FILE_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include "PageLog.hpp"
+#include "IoRing.hpp"
+#include "../util/Stats.hpp"
+
+class File;
+
+namespace Files { //every open file, for NamedSnapshots
+  list<File *> opened;
+}
+
+//a file under storage/ accessed at explicit offsets. all file traffic of the stores goes through here,
+//so it is where the traffic is counted, and where pages are saved for the latest named snapshot
+class File {
+  int fd;
+  long long length;
+  long long position = 0; //end of the previous access
+
+  void access(long long loc, int size) {
+    if (loc != position) {
+      stats.seeks++;
+    }
+    position = loc + size;
+  }
+
+  //after a read which came short. past the end of the file the record reads as zeros. anything else is an i/o error,
+  //which is counted as corrupt, since the zeros it reads as are not what was stored
+  void shortRead(long long loc, void *ptr, int size, long long got) {
+    if (got < 0 || loc + size <= length) {
+      stats.corrupt++;
+    }
+    memset(ptr, 0, size);
+  }
+
+public:
+  StorageStats stats;
+  PageLog *log = nullptr; //of the latest named snapshot. owned by NamedSnapshots
+
+  explicit File(const std::string &file_name) {
+    stats.name = file_name;
+    Stats::add(&stats);
+    Files::opened.push_back(this);
+    std::filesystem::create_directory("storage");
+    fd = open(path().c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    length = fd >= 0 && fstat(fd, &st) == 0 ? st.st_size : 0;
+    if (fd < 0) { //a store without its file would read as empty, and its writes would be lost
+      std::cerr << "cannot open " << path() << ": " << strerror(errno) << std::endl;
+      std::exit(1);
+    }
+  }
+
+  File(const File &) = delete;
+
+  File &operator=(const File &) = delete;
+
+  ~File() {
+    if (fd >= 0) {
+      close(fd);
+    }
+    Stats::remove(&stats);
+    for (size_t i = 0; i < Files::opened.size(); i++) {
+      if (Files::opened[i] == this) {
+        Files::opened[i] = Files::opened.back();
+        Files::opened.pop_back();
+        break;
+      }
+    }
+  }
+
+  const std::string &name() const {
+    return stats.name;
+  }
+
+  static std::string pathOf(const std::string &file_name) {
+    return "storage/" + file_name + ".dat";
+  }
+
+  std::string path() const {
+    return pathOf(name());
+  }
+
+  long long size() const {
+    return length;
+  }
+
+  void read(long long loc, void *ptr, int size) {
+    access(loc, size);
+    stats.read(size);
+    long long got = pread(fd, ptr, size, loc);
+    if (got != size) {
+      shortRead(loc, ptr, size, got);
+    }
+  }
+
+  //read a batch at once (see IoRing). a record past the end of the file is read as zeros, like in read
+  void readAll(IoRequest *requests, int count) {
+    for (int i = 0; i < count; i++) {
+      access(requests[i].loc, requests[i].size);
+      stats.read(requests[i].size);
+    }
+    IoRing::local().run(fd, requests, count, false);
+    for (int i = 0; i < count; i++) {
+      IoRequest &request = requests[i];
+      if (request.result == request.size) {
+        continue;
+      }
+      long long got = pread(fd, request.ptr, request.size, request.loc);
+      if (got != request.size) {
+        shortRead(request.loc, request.ptr, request.size, got);
+      }
+    }
+  }
+
+  void writeAll(IoRequest *requests, int count) {
+    for (int i = 0; i < count; i++) {
+      access(requests[i].loc, requests[i].size);
+      stats.write(requests[i].size);
+      if (log) {
+        log->preserve(fd, requests[i].loc, requests[i].size);
+      }
+    }
+    IoRing::local().run(fd, requests, count, true);
+    for (int i = 0; i < count; i++) {
+      IoRequest &request = requests[i];
+      if (request.result != request.size) { //a short write, or an opcode the kernel does not know
+        request.result = pwrite(fd, request.ptr, request.size, request.loc);
+      }
+      if (request.result == request.size && request.loc + request.size > length) {
+        length = request.loc + request.size;
+      }
+    }
+  }
+
+  //ask the kernel to start reading a range in the background, so that a later read finds it in the page cache
+  void prefetch(long long loc, int size) {
+    if (loc >= 0 && loc < length) {
+      posix_fadvise(fd, loc, size, POSIX_FADV_WILLNEED);
+    }
+  }
+
+  void write(long long loc, const void *ptr, int size) {
+    access(loc, size);
+    stats.write(size);
+    if (log) {
+      log->preserve(fd, loc, size);
+    }
+    if (pwrite(fd, ptr, size, loc) == size && loc + size > length) {
+      length = loc + size;
+    }
+  }
+
+  //put fresh in place of this file. the rename is atomic, so the path holds either file as a whole even after a
+  //crash, as fresh is on disk before and the directory is synced after. fresh is left closed. false if the rename
+  //failed, and nothing changed
+  bool replace(File &fresh) {
+    fdatasync(fresh.fd);
+    if (rename(fresh.path().c_str(), path().c_str()) != 0) {
+      return false;
+    }
+    int directory = open(std::filesystem::path(path()).parent_path().c_str(), O_RDONLY | O_DIRECTORY);
+    if (directory >= 0) {
+      fsync(directory);
+      close(directory);
+    }
+    close(fd);
+    fd = fresh.fd;
+    length = fresh.length;
+    position = -1;
+    fresh.fd = -1;
+    fresh.length = 0;
+    return true;
+  }
+
+  //delete the file from storage/. it is left empty, and closed once the object goes
+  void remove() {
+    unlink(path().c_str());
+    truncate(0);
+  }
+
+  void truncate(long long size) {
+    if (log && size < length) {
+      log->preserve(fd, size, length - size);
+    }
+    if (ftruncate(fd, size) == 0) {
+      length = size;
+    }
+  }
+};
+
+#endif
@@ -2,28 +2,74 @@
 #define TICKETSYSTEM2024_FILE_STORAGE_HPP
 
 #include <fstream>
-#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include "File.hpp"
+#include "Sealed.hpp"
 #include "../util/Exceptions.hpp"
+#include "../util/OptimisticLock.hpp"
+#include "../util/Snapshot.hpp"
+#include "../data_structure/list.hpp"
+#include "../data_structure/allocator.hpp"
+#include "../data_structure/hash_table.hpp"
+#include "../data_structure/top_k.hpp"
 
 using std::string;
 using std::fstream;
 using std::ifstream;
 using std::ofstream;
 
-//file storage with map cache. for small cache size.
+//file storage with a cache of frames found by record index in an open-addressing table, the frames themselves cut
+//from slabs. for small cache size.
+//get may run in many threads alongside one thread which changes the storage. so may checkCache for snapshot readers,
+//which are handed images of the records instead (see Snapshot), but not for other readers
 template<class T, class INFO, int CACHE_SIZE>
 class FileStorage {
-  struct Cache {
-    T data;
-    bool dirty;
+  struct Cache : Sealed<T> { //data comes first, so that it can be turned back into its frame
+    bool dirty = false;
+    int index = -1;
+    OptimisticLock lock;
+    Versions<T> versions;
   };
+
+  //a copy of the storage being written into a fresh file while the storage is in use, see beginRewrite
+  struct Rewrite {
+    File file;
+    int count = 0; //records in file
+    map<int, int> slots; //the index in file of each record copied
+    map<int, int> links; //the link of each record when it was copied, until it changes
+    map<int, bool> changed; //records added or changed since they were copied (true) or removed (false)
+
+    explicit Rewrite(const string &file_name) : file(file_name) {
+      file.truncate(0); //left over by a crash
+    }
+  };
+
   static constexpr int T_SIZE = sizeof(T);
+  static constexpr int RECORD_SIZE = sizeof(Sealed<T>); //in file
   static constexpr int INFO_SIZE = sizeof(INFO);
   static constexpr int INT_SIZE = sizeof(int);
-  fstream file;
-  string fileName;
-  map<int, Cache> cacheMap;
+  static constexpr int BATCH = 64; //records read or written back at once
+
+  struct Frame {
+    int record;
+    Cache *cache;
+    using INDEX = int;
+
+    const INDEX &index() const {
+      return record;
+    }
+  };
+
+  File file;
+  hash_table<Frame> frames; //the cached records by index
+  pool_allocator slab; //where the frames come from
+  list<Cache *> retired; //removed frames which readers may still look at
+  VersionedFrames<Cache> versioned;
+  std::shared_mutex latch; //guards frames, slab and file
   int empty;
+  Rewrite *rewrite = nullptr;
+  bool discarded = false; //leave the file as it is on destruction
 
   int getEmpty() {
     return empty;
@@ -34,96 +80,470 @@ class FileStorage {
   }
 
   static int getIndex(int loc) {
-    return (loc - INFO_SIZE - INT_SIZE) / T_SIZE;
+    return (loc - INFO_SIZE - INT_SIZE) / RECORD_SIZE;
   }
 
   static int getLoc(int index) {
-    return index * T_SIZE + INFO_SIZE + INT_SIZE;
+    return index * RECORD_SIZE + INFO_SIZE + INT_SIZE;
+  }
+
+  Cache *cached(int index) {
+    Frame *frame = frames.find(index);
+    return frame ? frame->cache : nullptr;
   }
+
+  Cache *newFrame(int index) {
+    Cache *cache = slab.template create<Cache>();
+    cache->index = index;
+    frames.insert({index, cache});
+    return cache;
+  }
+
+  void deleteFrames(list<Cache *> &caches) {
+    for (Cache *cache: caches) {
+      slab.destroy(cache);
+    }
+    caches.clear();
+  }
+
+  void dropFrames() { //under the exclusive latch
+    frames.forEach([this](Frame &frame) {
+      slab.destroy(frame.cache);
+    });
+    frames.clear();
+    deleteFrames(retired);
+  }
+
+  Cache *load(int index) { //under the exclusive latch
+    Cache *cache = cached(index);
+    if (cache) { //another reader may have loaded it meanwhile
+      return cache;
+    }
+    cache = newFrame(index);
+    file.read(getLoc(index), static_cast<Sealed<T> *>(cache), RECORD_SIZE);
+    file.stats.misses++;
+    if (!cache->intact()) { //or a slot freed after the reader found it, which the reader finds out by itself
+      file.stats.corrupt++;
+    }
+    return cache;
+  }
+
+  static bool afterInFile(Cache *const &lhs, Cache *const &rhs) {
+    return lhs->index > rhs->index;
+  }
+
+  void writeBack() { //write the dirty frames in batches, in file order. under the exclusive latch
+    top_k<Cache *> dirty(afterInFile);
+    frames.forEach([&dirty](Frame &frame) {
+      if (frame.cache->dirty) {
+        dirty.push(frame.cache);
+      }
+    });
+    const list<Cache *> &caches = dirty.sorted();
+    IoRequest requests[BATCH];
+    int count = 0;
+    for (size_t i = 0; i < caches.size(); i++) {
+      Cache *cache = caches[i];
+      cache->seal();
+      requests[count++] = {getLoc(cache->index), static_cast<Sealed<T> *>(cache), RECORD_SIZE, 0};
+      cache->dirty = false;
+      if (count == BATCH) {
+        file.writeAll(requests, count);
+        count = 0;
+      }
+    }
+    file.writeAll(requests, count);
+  }
+
+  void track(int index, bool live) { //in the writer thread
+    if (rewrite) {
+      rewrite->changed[index] = live;
+    }
+  }
+
+  //the slot of a record in the fresh file. every record linked to must have one
+  int relocate(int index) {
+    return index == -1 ? -1 : rewrite->slots.at(index);
+  }
+
+  void writeCopy(int slot, T &record) {
+    T::relink(record, relocate(T::linkOf(record)));
+    Sealed<T> sealed{record, 0};
+    sealed.seal();
+    rewrite->file.write(getLoc(slot), &sealed, RECORD_SIZE);
+  }
+
+  //keep the record for snapshot readers before it changes
+  void beforeWrite(Cache *cache) {
+    if (cache->versions.write(cache->data)) {
+      versioned.add(cache);
+    }
+  }
+
+  //whether a frame must stay in place since snapshot readers may resolve it
+  static bool pinned(Cache *cache) {
+    return Snapshot::active() || !cache->versions.empty();
+  }
+
   //store pointer to first empty just after info len.
   //empty except end has pointer to next empty; check EOF to determine whether at end. (so don't store anything after this)
 public:
   INFO info;
 
-  FileStorage(const INFO &initInfo, const string &file_name) : fileName("storage/" + file_name + ".dat") {
+  FileStorage(const INFO &initInfo, const string &file_name) : file(file_name) {
     newFile(initInfo);
-    file.open(fileName, std::ios::in | std::ios::out | std::ios::binary);
-    file.read(reinterpret_cast<char *>(&info), INFO_SIZE);
-    file.read(reinterpret_cast<char *>(&empty), INT_SIZE);
+    file.read(0, &info, INFO_SIZE);
+    file.read(INFO_SIZE, &empty, INT_SIZE);
   }
 
   ~FileStorage() {
-    file.seekp(0);
-    file.write(reinterpret_cast<const char *>(&info), INFO_SIZE);
-    file.write(reinterpret_cast<const char *>(&empty), INT_SIZE);
-    checkCache();
-    file.close();
+    cancelRewrite();
+    if (!discarded) {
+      file.write(0, &info, INFO_SIZE);
+      file.write(INFO_SIZE, &empty, INT_SIZE);
+      flush();
+    }
+    dropFrames(); //frames kept for snapshot readers
   }
 
-  void checkCache() {
-    if(T_SIZE * cacheMap.size() > CACHE_SIZE) {
-      for(const auto &it : cacheMap) {
-        if(it.second.dirty) {
-          file.seekp(it.first);
-          file.write(reinterpret_cast<const char *>(&it.second.data), T_SIZE);
-        }
+  //write back all frames and evict those which hold no image
+  void flush() {
+    std::unique_lock guard(latch);
+    writeBack();
+    list<Frame> kept;
+    frames.forEach([this, &kept](Frame &frame) {
+      if (frame.cache->versions.empty()) {
+        slab.destroy(frame.cache);
+      } else {
+        kept.push_back(frame);
       }
-      cacheMap.clear();
+    });
+    frames.clear();
+    for (size_t i = 0; i < kept.size(); i++) {
+      frames.insert(kept[i]);
+    }
+    deleteFrames(retired);
+  }
+
+  //write the header and all frames back, so that the file alone holds the storage
+  void checkpoint() {
+    file.write(0, &info, INFO_SIZE);
+    file.write(INFO_SIZE, &empty, INT_SIZE);
+    flush();
+  }
+
+  //drop the cache without writing it back and read the header again, after the file has changed underneath.
+  //no reader may be running
+  void reload() {
+    std::unique_lock guard(latch);
+    dropFrames();
+    versioned.clear();
+    file.read(0, &info, INFO_SIZE);
+    file.read(INFO_SIZE, &empty, INT_SIZE);
+  }
+
+  //drop the cache, and write nothing back when the storage is destroyed, after the file has changed underneath.
+  //no reader may be running, and the storage may not be used after, but for its destruction
+  void discard() {
+    std::unique_lock guard(latch);
+    dropFrames();
+    versioned.clear();
+    discarded = true;
+  }
+
+  void checkCache() {
+    versioned.collect();
+    if(T_SIZE * frames.size() > CACHE_SIZE) {
+      flush();
+    } else if (!retired.empty()) {
+      std::unique_lock guard(latch); //readers may be cutting frames from the slab
+      deleteFrames(retired);
     }
   }
 
+  //the number of record slots in file, free ones included
+  int slots() const {
+    return getIndex((int) file.size());
+  }
+
+  //delete the file. the storage may not be used after, but for its destruction
+  void unlink() {
+    file.remove();
+  }
+
   void newFile(const INFO &initInfo) {
-    if (std::filesystem::exists(fileName)) {
+    if (file.size() > 0) {
       return;
     }
-    std::filesystem::create_directory("storage");
-    file.open(fileName, std::ios::out | std::ios::binary);
     int initEmpty = INFO_SIZE + INT_SIZE;
-    file.write(reinterpret_cast<const char *>(&initInfo), INFO_SIZE);
-    file.write(reinterpret_cast<const char *>(&initEmpty), INT_SIZE);
-    file.close();
+    file.write(0, &initInfo, INFO_SIZE);
+    file.write(INFO_SIZE, &initEmpty, INT_SIZE);
   }
 
   int add(const T &t) {
+    std::unique_lock guard(latch);
     int loc = getEmpty();
-    file.seekg(loc);
     int nxt;
-    if (file.peek() == EOF) {
-      nxt = loc + T_SIZE;
-      file.clear(); //clear EOF flag
+    if (loc >= file.size()) {
+      nxt = loc + RECORD_SIZE;
     } else {
-      file.read(reinterpret_cast<char *>(&nxt), INT_SIZE);
+      file.read(loc, &nxt, INT_SIZE);
     }
-    file.seekp(loc);
-    file.write(reinterpret_cast<const char *>(&t), T_SIZE);
+    Sealed<T> record{t, 0};
+    record.seal();
+    file.write(loc, &record, RECORD_SIZE);
     setEmpty(nxt);
-    return getIndex(loc);
+    int index = getIndex(loc);
+    track(index, true);
+    Cache *cache = cached(index);
+    if (cache && pinned(cache)) { //the frame of the removed record is kept for snapshot readers
+      beforeWrite(cache);
+      cache->data = t;
+      cache->dirty = false;
+      cache->lock.revive();
+    } else if (cache) { //a reader loaded the free slot after it was removed
+      cache->lock.markObsolete();
+      retired.push_back(cache);
+      frames.erase(index);
+    }
+    return index;
   }
 
+  //a snapshot reader gets the image of the record as of its epoch
   T *get(int index, bool dirty) {
-    int loc = getLoc(index);
-    auto it = cacheMap.find(loc);
-    if (it == cacheMap.end()) {
-      it = cacheMap.insert({loc, {}}).first;
-      file.seekg(loc);
-      file.read(reinterpret_cast<char *>(&it->second.data), T_SIZE);
+    Cache *cache;
+    if (Snapshot::reading()) {
+      while (true) {
+        {
+          std::shared_lock guard(latch); //the frame may not be evicted until the image is resolved
+          cache = cached(index);
+          if (cache) {
+            std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+            bool first;
+            T *ret = cache->versions.read(cache->data, first);
+            if (first) {
+              versioned.add(cache);
+            }
+            return ret;
+          }
+        }
+        std::unique_lock guard(latch);
+        load(index);
+      }
+    }
+    {
+      std::shared_lock guard(latch);
+      cache = cached(index);
+    }
+    if (cache) {
+      std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+    } else {
+      std::unique_lock guard(latch);
+      cache = load(index);
     }
     if(dirty) {
-      it->second.dirty = true;
+      beforeWrite(cache);
+      cache->dirty = true;
+      track(index, true);
     }
-    return &it->second.data;
+    return &cache->data;
+  }
+
+  //load the records at the given indices which are not cached with a batch of reads, so that the device works on
+  //all of them at once and get then finds them in the cache. may run alongside get like load does
+  void fetch(const list<int> &indices) {
+    int count = indices.size();
+    IoRequest requests[BATCH];
+    std::unique_lock guard(latch);
+    for (int first = 0; first < count; first += BATCH) {
+      int n = 0;
+      for (int i = first; i < count && i < first + BATCH; i++) {
+        if (indices[i] < 0 || cached(indices[i])) {
+          continue;
+        }
+        Cache *cache = newFrame(indices[i]); //readers wait on the latch before they can see it
+        requests[n++] = {getLoc(indices[i]), static_cast<Sealed<T> *>(cache), RECORD_SIZE, 0};
+      }
+      file.readAll(requests, n);
+      file.stats.misses += n;
+      for (int i = 0; i < n; i++) {
+        if (!static_cast<Sealed<T> *>(requests[i].ptr)->intact()) {
+          file.stats.corrupt++;
+        }
+      }
+    }
+  }
+
+  //check every record in file against its checksum, skipping the free slots. the frames must have been written
+  //back. return the number of bad records
+  int scrub() {
+    std::unique_lock guard(latch);
+    int count = slots();
+    list<bool> free;
+    for (int i = 0; i < count; i++) {
+      free.push_back(false);
+    }
+    int loc = empty;
+    for (int i = 0; i < count && loc >= INFO_SIZE + INT_SIZE && getIndex(loc) < count; i++) { //the free list
+      free[getIndex(loc)] = true;
+      file.read(loc, &loc, INT_SIZE);
+    }
+    return scrubRecords<T>(file, getLoc(0), count, free);
+  }
+
+  //hint that the record will be read soon. does nothing if it is cached. index may be stale or torn
+  void prefetch(int index) {
+    if (index < 0) {
+      return;
+    }
+    std::shared_lock guard(latch);
+    if (!cached(index)) {
+      file.prefetch(getLoc(index), RECORD_SIZE);
+    }
+  }
+
+  //mark data returned by get as dirty and return its latch
+  OptimisticLock &modify(T *data) {
+    Cache *cache = reinterpret_cast<Cache *>(data);
+    beforeWrite(cache);
+    cache->dirty = true;
+    track(cache->index, true);
+    return cache->lock;
+  }
+
+  static OptimisticLock &lockOf(T *data) {
+    return reinterpret_cast<Cache *>(data)->lock;
   }
 
   void remove(int index) {
+    std::unique_lock guard(latch);
     int loc = getLoc(index);
-    auto it = cacheMap.find(loc);
-    if(it != cacheMap.end()) {
-      cacheMap.erase(it);
+    Cache *cache = cached(index);
+    if (!cache && Snapshot::active()) { //the record is about to be overwritten in file
+      cache = load(index);
+    }
+    if (cache && pinned(cache)) { //snapshot readers may still resolve the record, so the frame stays
+      beforeWrite(cache);
+      cache->lock.markObsolete();
+      cache->dirty = false;
+    } else if (cache) {
+      cache->lock.markObsolete();
+      retired.push_back(cache);
+      frames.erase(index);
     }
     int nxt = getEmpty();
     setEmpty(loc);
-    file.seekp(loc);
-    file.write(reinterpret_cast<const char *>(&nxt), INT_SIZE);
+    file.write(loc, &nxt, INT_SIZE);
+    track(index, false);
+  }
+
+  //rewriting, or compaction: the records are copied one by one into a fresh file in the order the caller walks
+  //them, while the storage is in use, and the fresh file then takes the place of the file. a record may link to
+  //another, like the leaves of a tree do (T::linkOf and T::relink, with -1 for none), and the copy links to the
+  //copy of that one. the changes made meanwhile are tracked, so only the writer thread may run the rewrite
+
+  void beginRewrite() {
+    rewrite = new Rewrite(file.name() + "_new");
+  }
+
+  //give up the rewrite and delete the fresh file
+  void cancelRewrite() {
+    if (rewrite) {
+      rewrite->file.remove();
+      delete rewrite;
+      rewrite = nullptr;
+    }
+  }
+
+  bool rewriting() const {
+    return rewrite != nullptr;
+  }
+
+  //whether the record at index was copied and has not been removed since. an index removed meanwhile may have
+  //been taken by a new record, which is copied at the end
+  bool copied(int index) const {
+    return rewrite->slots.find(index) != rewrite->slots.end();
+  }
+
+  bool removedSinceBegin(int index) const {
+    auto it = rewrite->changed.find(index);
+    return it != rewrite->changed.end() && !it->second;
+  }
+
+  //copy the record at index next, and return the index it links to. the copy links to the slot after its own, as
+  //the caller is presumed to copy that record next. finishRewrite corrects the links where it did not
+  int copy(int index) {
+    T record = *get(index, false);
+    int slot = rewrite->count++;
+    rewrite->slots[index] = slot;
+    auto it = rewrite->changed.find(index);
+    if (it != rewrite->changed.end()) { //the copy is as of now
+      rewrite->changed.erase(it);
+    }
+    int link = T::linkOf(record);
+    rewrite->links[index] = link;
+    T::relink(record, link == -1 ? -1 : slot + 1);
+    Sealed<T> sealed{record, 0};
+    sealed.seal();
+    rewrite->file.write(getLoc(slot), &sealed, RECORD_SIZE);
+    return link;
+  }
+
+  //copy again what changed since it was copied, append the records added meanwhile, chain the slots of the removed
+  //ones into the free list, and put the fresh file in place of the file. every record must have been copied but
+  //for those added meanwhile. slots gets the new index of every record, for the links from outside the storage.
+  //no reader may be running. false if the file could not be replaced, which leaves everything as it was
+  bool finishRewrite(map<int, int> &slots) {
+    list<int> holes;
+    for (const auto &it: rewrite->changed) {
+      auto slot = rewrite->slots.find(it.first);
+      auto link = rewrite->links.find(it.first);
+      if (link != rewrite->links.end()) {
+        rewrite->links.erase(link);
+      }
+      if (!it.second && slot != rewrite->slots.end()) {
+        holes.push_back(slot->second);
+        rewrite->slots.erase(slot);
+      } else if (it.second && slot == rewrite->slots.end()) {
+        rewrite->slots[it.first] = rewrite->count++;
+      }
+    }
+    for (const auto &it: rewrite->changed) {
+      if (it.second) {
+        T record = *get(it.first, false);
+        writeCopy(rewrite->slots.at(it.first), record);
+      }
+    }
+    for (const auto &it: rewrite->links) { //copies unchanged since, which may link to another slot than presumed
+      int slot = rewrite->slots.at(it.first);
+      if (it.second != -1 && relocate(it.second) != slot + 1) {
+        T record = *get(it.first, false);
+        writeCopy(slot, record);
+      }
+    }
+    int newEmpty = getLoc(rewrite->count);
+    char *hole = new char[RECORD_SIZE]();
+    for (int slot: holes) {
+      memcpy(hole, &newEmpty, INT_SIZE);
+      rewrite->file.write(getLoc(slot), hole, RECORD_SIZE);
+      newEmpty = getLoc(slot);
+    }
+    delete[] hole;
+    rewrite->file.write(0, &info, INFO_SIZE);
+    rewrite->file.write(INFO_SIZE, &newEmpty, INT_SIZE);
+    std::unique_lock guard(latch);
+    if (!file.replace(rewrite->file)) {
+      guard.unlock();
+      cancelRewrite();
+      return false;
+    }
+    dropFrames(); //every record is in the fresh file as it is now
+    versioned.clear();
+    empty = newEmpty;
+    slots = rewrite->slots;
+    delete rewrite;
+    rewrite = nullptr;
+    return true;
   }
 };
 
@@ -0,0 +1,137 @@
+#ifndef TICKETSYSTEM2024_FRAME_DIRECTORY_HPP
+#define TICKETSYSTEM2024_FRAME_DIRECTORY_HPP
+
+#include <atomic>
+#include <cstdlib>
+
+//the frames of a store by record index, in segments of SEGMENT frames which are made when a record in them is first
+//cached, found through a directory which doubles as the file grows. so there is no bound on the records, and the
+//memory follows the records there are. readers look frames up without a latch while the writer thread stores them,
+//so a directory which has been doubled is kept until the end, since a reader may still look at it. the old
+//directories add up to less than the current one. segments and old directories are only freed by clear
+template<typename Cache>
+class FrameDirectory {
+  static constexpr int SEGMENT_BITS = 10;
+  static constexpr int SEGMENT = 1 << SEGMENT_BITS;
+  static constexpr int MIN_CAPACITY = 4; //segments in the first directory
+
+  struct Segment {
+    std::atomic<Cache *> frames[SEGMENT]{};
+  };
+
+  struct Directory {
+    int capacity; //segments
+    Directory *older;
+    std::atomic<Segment *> segments[]; //zeroed, as calloc makes it
+  };
+
+  std::atomic<Directory *> directory;
+
+  static Directory *makeDirectory(int capacity, Directory *older) {
+    size_t size = sizeof(Directory) + capacity * sizeof(std::atomic<Segment *>);
+    Directory *ret = static_cast<Directory *>(calloc(1, size));
+    ret->capacity = capacity;
+    ret->older = older;
+    return ret;
+  }
+
+  //a directory which has the segment s. in the writer thread
+  Directory *grow(int s) {
+    Directory *old = directory.load(std::memory_order_relaxed);
+    int capacity = old->capacity;
+    while (capacity <= s) {
+      capacity *= 2;
+    }
+    Directory *ret = makeDirectory(capacity, old);
+    for (int i = 0; i < old->capacity; i++) {
+      ret->segments[i].store(old->segments[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    directory.store(ret, std::memory_order_release);
+    return ret;
+  }
+
+public:
+  FrameDirectory() : directory(makeDirectory(MIN_CAPACITY, nullptr)) {}
+
+  FrameDirectory(const FrameDirectory &) = delete;
+
+  FrameDirectory &operator=(const FrameDirectory &) = delete;
+
+  ~FrameDirectory() {
+    clear();
+    Directory *dir = directory.load(std::memory_order_relaxed);
+    while (dir) {
+      Directory *older = dir->older;
+      free(dir);
+      dir = older;
+    }
+  }
+
+  //the frame of the record at index, or nullptr if it is not cached
+  Cache *find(int index, std::memory_order order = std::memory_order_acquire) const {
+    Directory *dir = directory.load(std::memory_order_acquire);
+    int s = index >> SEGMENT_BITS;
+    if (s >= dir->capacity) {
+      return nullptr;
+    }
+    Segment *segment = dir->segments[s].load(std::memory_order_acquire);
+    return segment ? segment->frames[index & (SEGMENT - 1)].load(order) : nullptr;
+  }
+
+  //in the writer thread, or under the exclusive latch of the store. cache may be nullptr
+  void store(int index, Cache *cache, std::memory_order order = std::memory_order_release) {
+    Directory *dir = directory.load(std::memory_order_relaxed);
+    int s = index >> SEGMENT_BITS;
+    if (s >= dir->capacity) {
+      if (!cache) {
+        return;
+      }
+      dir = grow(s);
+    }
+    Segment *segment = dir->segments[s].load(std::memory_order_relaxed);
+    if (!segment) {
+      if (!cache) {
+        return;
+      }
+      segment = new Segment();
+      dir->segments[s].store(segment, std::memory_order_release);
+    }
+    segment->frames[index & (SEGMENT - 1)].store(cache, order);
+  }
+
+  //call f(index, frame) on every frame in the order of the indices
+  template<typename F>
+  void forEach(F f) const {
+    Directory *dir = directory.load(std::memory_order_relaxed);
+    for (int s = 0; s < dir->capacity; s++) {
+      Segment *segment = dir->segments[s].load(std::memory_order_relaxed);
+      if (!segment) {
+        continue;
+      }
+      for (int i = 0; i < SEGMENT; i++) {
+        Cache *cache = segment->frames[i].load(std::memory_order_relaxed);
+        if (cache) {
+          f((s << SEGMENT_BITS) | i, cache);
+        }
+      }
+    }
+  }
+
+  //drop all frames, which must have been freed, and free the segments and the old directories. no reader may be
+  //running
+  void clear() {
+    Directory *dir = directory.load(std::memory_order_relaxed);
+    for (int s = 0; s < dir->capacity; s++) {
+      delete dir->segments[s].exchange(nullptr, std::memory_order_relaxed);
+    }
+    Directory *older = dir->older;
+    while (older) { //they only had segments the current one has
+      Directory *next = older->older;
+      free(older);
+      older = next;
+    }
+    dir->older = nullptr;
+  }
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef TICKETSYSTEM2024_IO_RING_HPP
+#define TICKETSYSTEM2024_IO_RING_HPP
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+//one read or write of a batch. result is the number of bytes moved, or a negative errno
+struct IoRequest {
+  long long loc;
+  void *ptr;
+  int size;
+  int result;
+};
+
+//a minimal io_uring, driven by the raw system calls since liburing is not a dependency. a batch is put into the
+//submission ring as a whole and the kernel works on all of it at once, which keeps many reads in flight on devices
+//which serve them in parallel. each thread has its own ring. where io_uring is missing or forbidden the batch is
+//run with pread and pwrite one by one
+class IoRing {
+  static constexpr unsigned DEPTH = 64;
+  static constexpr int MIN_BATCH = 4; //smaller batches gain nothing from the ring, which costs more than pread
+
+  int fd = -1;
+  void *sqMap = MAP_FAILED;
+  void *cqMap = MAP_FAILED;
+  size_t sqMapSize = 0;
+  size_t cqMapSize = 0;
+  io_uring_sqe *sqes = (io_uring_sqe *) MAP_FAILED;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  io_uring_cqe *cqes;
+  unsigned entries = 0;
+
+  IoRing() {
+    io_uring_params params{};
+    fd = (int) syscall(__NR_io_uring_setup, DEPTH, &params);
+    if (fd < 0) {
+      return;
+    }
+    sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+      sqMapSize = cqMapSize = sqMapSize > cqMapSize ? sqMapSize : cqMapSize;
+    }
+    entries = params.sq_entries;
+    sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap != MAP_FAILED) {
+      cqMap = single ? sqMap : mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                    IORING_OFF_CQ_RING);
+    }
+    if (cqMap != MAP_FAILED) {
+      sqes = (io_uring_sqe *) mmap(nullptr, entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    }
+    if (sqes == MAP_FAILED) {
+      close();
+      return;
+    }
+    char *sq = (char *) sqMap;
+    char *cq = (char *) cqMap;
+    sqTail = (unsigned *) (sq + params.sq_off.tail);
+    sqMask = (unsigned *) (sq + params.sq_off.ring_mask);
+    sqArray = (unsigned *) (sq + params.sq_off.array);
+    cqHead = (unsigned *) (cq + params.cq_off.head);
+    cqTail = (unsigned *) (cq + params.cq_off.tail);
+    cqMask = (unsigned *) (cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+  }
+
+  void close() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, entries * sizeof(io_uring_sqe));
+    }
+    if (cqMap != MAP_FAILED && cqMap != sqMap) {
+      munmap(cqMap, cqMapSize);
+    }
+    if (sqMap != MAP_FAILED) {
+      munmap(sqMap, sqMapSize);
+    }
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    sqes = (io_uring_sqe *) MAP_FAILED;
+    sqMap = cqMap = MAP_FAILED;
+    fd = -1;
+    entries = 0;
+  }
+
+  //submit count <= entries requests and wait for all of them
+  bool submit(int file, IoRequest *requests, int count, bool write) {
+    unsigned tail = *sqTail; //only this thread adds entries
+    for (int i = 0; i < count; i++) {
+      unsigned slot = (tail + i) & *sqMask;
+      io_uring_sqe &sqe = sqes[slot];
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe.fd = file;
+      sqe.off = requests[i].loc;
+      sqe.addr = (unsigned long long) requests[i].ptr;
+      sqe.len = requests[i].size;
+      sqe.user_data = i;
+      sqArray[slot] = slot;
+    }
+    std::atomic_ref(*sqTail).store(tail + count, std::memory_order_release);
+    int submitted = 0;
+    int completed = 0;
+    while (completed < count) {
+      int ret = (int) syscall(__NR_io_uring_enter, fd, count - submitted, count - completed, IORING_ENTER_GETEVENTS,
+                              nullptr, 0);
+      if (ret < 0 && errno != EINTR) {
+        return false; //the entries are lost with the ring, so the caller runs the batch again itself
+      }
+      if (ret > 0) {
+        submitted += ret;
+      }
+      unsigned head = *cqHead;
+      unsigned end = std::atomic_ref(*cqTail).load(std::memory_order_acquire);
+      for (; head != end; head++) {
+        io_uring_cqe &cqe = cqes[head & *cqMask];
+        requests[cqe.user_data].result = cqe.res;
+        completed++;
+      }
+      std::atomic_ref(*cqHead).store(head, std::memory_order_release);
+    }
+    return true;
+  }
+
+  static void fallback(int file, IoRequest *requests, int count, bool write) {
+    for (int i = 0; i < count; i++) {
+      IoRequest &request = requests[i];
+      request.result = (int) (write ? pwrite(file, request.ptr, request.size, request.loc)
+                                    : pread(file, request.ptr, request.size, request.loc));
+    }
+  }
+
+public:
+  IoRing(const IoRing &) = delete;
+
+  IoRing &operator=(const IoRing &) = delete;
+
+  ~IoRing() {
+    close();
+  }
+
+  static IoRing &local() {
+    thread_local IoRing ring;
+    return ring;
+  }
+
+  bool available() const {
+    return fd >= 0;
+  }
+
+  //run all requests on file and fill in their results
+  void run(int file, IoRequest *requests, int count, bool write) {
+    if (!available() || count < MIN_BATCH) {
+      return fallback(file, requests, count, write);
+    }
+    for (int first = 0; first < count; first += (int) entries) {
+      int n = count - first < (int) entries ? count - first : (int) entries;
+      if (!submit(file, requests + first, n, write)) {
+        close();
+        fallback(file, requests + first, count - first, write);
+        return;
+      }
+    }
+  }
+};
+
+#endif
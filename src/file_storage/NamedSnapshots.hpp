@@ -0,0 +1,174 @@
+#ifndef TICKETSYSTEM2024_NAMED_SNAPSHOTS_HPP
+#define TICKETSYSTEM2024_NAMED_SNAPSHOTS_HPP
+
+#include <filesystem>
+#include <fstream>
+#include "File.hpp"
+#include "../data_structure/list.hpp"
+#include "../util/Util.hpp"
+
+//named snapshots of every open file by copy-on-write of pages (see PageLog). log i holds the pages changed after
+//snapshot i was taken and before snapshot i + 1 was, so a page of snapshot i is the first copy found in logs
+//i, i + 1, ..., or else the page as it is now. only the latest log takes pages, so without snapshots nothing is copied.
+//restore is a plain write of the pages, which keeps every snapshot valid.
+//the stores must write everything back before create, and read everything again after restore
+namespace NamedSnapshots {
+  constexpr int MAX_NAME_LENGTH = 16;
+  const std::string DIRECTORY = "storage/snapshot/";
+  const std::string NAMES = DIRECTORY + "names";
+
+  list<FixedString<MAX_NAME_LENGTH>> names; //in the order they were taken
+
+  std::string logPath(const std::string &name, const File *file) {
+    return DIRECTORY + name + "/" + file->name() + ".dat";
+  }
+
+  bool valid(const std::string &name) {
+    if (name.empty() || name.length() > MAX_NAME_LENGTH) {
+      return false;
+    }
+    for (char c: name) {
+      if (!isalnum((unsigned char) c)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  int find(const std::string &name) {
+    if (!valid(name)) {
+      return -1;
+    }
+    for (size_t i = 0; i < names.size(); i++) {
+      if (names[i].toString() == name) {
+        return (int) i;
+      }
+    }
+    return -1;
+  }
+
+  void save() {
+    std::ofstream file(NAMES, std::ios::trunc);
+    for (const auto &name: names) {
+      file << name << '\n';
+    }
+  }
+
+  void detach() {
+    for (size_t i = 0; i < Files::opened.size(); i++) {
+      delete Files::opened[i]->log;
+      Files::opened[i]->log = nullptr;
+    }
+  }
+
+  void attach() { //let the files save pages for the latest snapshot
+    detach();
+    if (names.empty()) {
+      return;
+    }
+    for (size_t i = 0; i < Files::opened.size(); i++) {
+      Files::opened[i]->log = new PageLog(logPath(names.back().toString(), Files::opened[i]), -1);
+    }
+  }
+
+  //the log of file for the latest snapshot. a file opened after the snapshot was taken had no pages then, as the
+  //stores only open files before that which they make afterwards, so it gets an empty log
+  PageLog *latestLog(File *file) {
+    if (!file->log) {
+      file->log = new PageLog(logPath(names.back().toString(), file), 0);
+    }
+    return file->log;
+  }
+
+  //must be called once the stores are open and before anything is written
+  void init() {
+    names.clear();
+    std::ifstream file(NAMES);
+    std::string name;
+    while (file >> name) {
+      names.push_back(name);
+    }
+    attach();
+  }
+
+  bool create(const std::string &name) {
+    if (!valid(name) || find(name) >= 0) {
+      return false;
+    }
+    std::filesystem::create_directories(DIRECTORY + name);
+    detach();
+    names.push_back(name);
+    save();
+    for (size_t i = 0; i < Files::opened.size(); i++) {
+      Files::opened[i]->log = new PageLog(logPath(name, Files::opened[i]), Files::opened[i]->size());
+    }
+    return true;
+  }
+
+  bool restore(const std::string &name) {
+    int first = find(name);
+    if (first < 0) {
+      return false;
+    }
+    int last = (int) names.size() - 1;
+    char data[PageLog::PAGE_SIZE];
+    for (size_t f = 0; f < Files::opened.size(); f++) {
+      File *file = Files::opened[f];
+      list<PageLog *> logs;
+      for (int i = first; i <= last; i++) {
+        logs.push_back(i == last ? latestLog(file) : new PageLog(logPath(names[i].toString(), file), -1));
+      }
+      long long length = logs[0]->fileLength();
+      map<long long, int> sources; //page to the first log holding it. collected first, since writes add to the last
+      for (int i = (int) logs.size() - 1; i >= 0; i--) {
+        for (auto it = logs[i]->saved().cbegin(); it != logs[i]->saved().cend(); ++it) {
+          if (it->first * PageLog::PAGE_SIZE < length) {
+            sources[it->first] = i;
+          }
+        }
+      }
+      for (auto it = sources.begin(); it != sources.end(); ++it) {
+        long long loc = it->first * PageLog::PAGE_SIZE;
+        logs[it->second]->load(it->first, data);
+        file->write(loc, data, (int) std::min<long long>(PageLog::PAGE_SIZE, length - loc));
+      }
+      file->truncate(length);
+      for (int i = 0; i < (int) logs.size() - 1; i++) {
+        delete logs[i];
+      }
+    }
+    return true;
+  }
+
+  //the pages of the snapshot which the one before it still needs move into its log
+  bool remove(const std::string &name) {
+    int index = find(name);
+    if (index < 0) {
+      return false;
+    }
+    int last = (int) names.size() - 1;
+    char data[PageLog::PAGE_SIZE];
+    for (size_t f = 0; index > 0 && f < Files::opened.size(); f++) {
+      File *file = Files::opened[f];
+      PageLog previous(logPath(names[index - 1].toString(), file), -1);
+      PageLog *log = index == last ? latestLog(file) : new PageLog(logPath(name, file), -1);
+      for (auto it = log->saved().cbegin(); it != log->saved().cend(); ++it) {
+        if (!previous.has(it->first)) {
+          log->load(it->first, data);
+          previous.save(it->first, data);
+        }
+      }
+      if (index != last) {
+        delete log;
+      }
+    }
+    detach();
+    std::filesystem::remove_all(DIRECTORY + name);
+    names.erase(index);
+    save();
+    attach();
+    return true;
+  }
+}
+
+#endif
@@ -0,0 +1,353 @@
+#ifndef TICKETSYSTEM2024_PACKED_STORAGE_HPP
+#define TICKETSYSTEM2024_PACKED_STORAGE_HPP
+
+#include <mutex>
+#include <shared_mutex>
+#include "File.hpp"
+#include "Sealed.hpp"
+#include "FrameDirectory.hpp"
+#include "../util/Crc32c.hpp"
+#include "../util/Lz.hpp"
+#include "../util/Snapshot.hpp"
+#include "../util/Util.hpp"
+
+using std::string;
+
+//records compressed in blocks, for records which are seldom changed once written, like orders and trains. T is
+//encoded into S, and every full block of BLOCK records is compressed (see Lz) into file, found through a table of
+//blocks. the last block, which is not full yet, is kept plain in a tail file. the cache holds whole blocks decoded,
+//so a block is decompressed once however many of its records are read. a full block which changes is compressed
+//again, in place if it still fits, or else at the end of file with some room to grow, leaving a hole.
+//snapshot readers may run alongside the writer thread and checkCache, and are handed images of the records (see Snapshot)
+template<typename T, int MAX_CACHE_COUNT>
+class PackedStorage {
+  typedef T::ENCODE S;
+  static constexpr int BLOCK_TARGET = 4096; //bytes of records in a block before compression
+  static constexpr int BLOCK = sizeof(S) >= BLOCK_TARGET ? 1 : BLOCK_TARGET / sizeof(S); //records
+  static constexpr int BLOCK_BYTES = BLOCK * sizeof(S);
+  static constexpr int HEADER_SIZE = sizeof(int); //of the table, the number of records
+  static constexpr int BATCH = 16; //blocks read at once
+
+  struct Entry { //where a full block is in file. capacity is the room it has there
+    long long loc;
+    int size;
+    int capacity;
+    unsigned checksum;
+  };
+
+  struct Cache {
+    T data;
+    Versions<T> versions;
+  };
+
+  struct Block {
+    Cache records[BLOCK];
+    bool dirty = false;
+
+    bool pinned() const { //images are handed out from the records
+      for (int i = 0; i < BLOCK; i++) {
+        if (!records[i].versions.empty()) {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+
+  File file; //the full blocks
+  File table; //the number of records, then the entry of each full block
+  File tail; //the records of the last block, sealed one by one
+  int count = 0; //records
+  list<Entry> entries; //of the full blocks
+  long long end = 0; //of the room taken in file
+  FrameDirectory<Block> blocks; //a map from block index to cache
+  int cacheCount = 0; //records in the cached blocks
+  VersionedFrames<Cache> versioned;
+  std::shared_mutex latch; //guards loading, eviction, entries and the files. snapshot readers hold it shared while they resolve an image
+
+  int recordsIn(int b) const {
+    return std::min(BLOCK, count - b * BLOCK);
+  }
+
+  void readTable() {
+    count = 0;
+    table.read(0, &count, HEADER_SIZE);
+    entries.clear();
+    end = 0;
+    for (int b = 0; b < count / BLOCK; b++) {
+      Entry entry;
+      table.read(HEADER_SIZE + b * (long long) sizeof(Entry), &entry, sizeof(Entry));
+      entries.push_back(entry);
+      end = std::max(end, entry.loc + entry.capacity);
+    }
+  }
+
+  //decompress a full block into raw. false if it is corrupt, which leaves raw zeroed
+  static bool unpack(const Entry &entry, const char *packed, S *raw) {
+    bool intact = crc32c(packed, entry.size) == entry.checksum &&
+                  lzDecompress(packed, entry.size, raw, BLOCK_BYTES) == BLOCK_BYTES;
+    if (!intact) {
+      memset(static_cast<void *>(raw), 0, BLOCK_BYTES);
+    }
+    return intact;
+  }
+
+  Block *newBlock(int b) { //under the exclusive latch
+    Block *block = new Block();
+    cacheCount += BLOCK;
+    blocks.store(b, block);
+    return block;
+  }
+
+  //decode the full block b from its compressed bytes and cache it. under the exclusive latch
+  Block *decode(int b, const char *packed) {
+    S *raw = new S[BLOCK];
+    if (!unpack(entries[b], packed, raw)) {
+      file.stats.corrupt++;
+    }
+    Block *block = new Block(); //published only once decoded, since readers look at blocks without the latch
+    for (int i = 0; i < BLOCK; i++) {
+      block->records[i].data = T(raw[i]);
+    }
+    delete[] raw;
+    cacheCount += BLOCK;
+    file.stats.misses++;
+    blocks.store(b, block);
+    return block;
+  }
+
+  Block *load(int b) { //under the exclusive latch
+    Block *block = blocks.find(b, std::memory_order_relaxed);
+    if (block) {
+      return block;
+    }
+    if (b < (int) entries.size()) {
+      char *packed = new char[entries[b].size];
+      file.read(entries[b].loc, packed, entries[b].size);
+      block = decode(b, packed);
+      delete[] packed;
+      return block;
+    }
+    int n = recordsIn(b);
+    Sealed<S> *sealed = new Sealed<S>[n];
+    tail.read(0, sealed, n * (int) sizeof(Sealed<S>));
+    block = new Block();
+    for (int i = 0; i < n; i++) {
+      if (!sealed[i].intact()) {
+        tail.stats.corrupt++;
+      }
+      block->records[i].data = T(sealed[i].data);
+    }
+    delete[] sealed;
+    cacheCount += BLOCK;
+    tail.stats.misses++;
+    blocks.store(b, block);
+    return block;
+  }
+
+  //compress the dirty full blocks into file, and seal the records of the last block into tail. under the
+  //exclusive latch
+  void writeBack() {
+    S *raw = new S[BLOCK]();
+    char *packed = new char[lzBound(BLOCK_BYTES)];
+    blocks.forEach([&](int b, Block *block) {
+      if (!block->dirty) {
+        return;
+      }
+      block->dirty = false;
+      if (b >= (int) entries.size()) {
+        int n = recordsIn(b);
+        Sealed<S> *sealed = new Sealed<S>[n];
+        for (int i = 0; i < n; i++) {
+          sealed[i].data = block->records[i].data.encode();
+          sealed[i].seal();
+        }
+        tail.write(0, sealed, n * (int) sizeof(Sealed<S>));
+        delete[] sealed;
+        return;
+      }
+      for (int i = 0; i < BLOCK; i++) {
+        raw[i] = block->records[i].data.encode();
+      }
+      Entry &entry = entries[b];
+      int size = lzCompress(raw, BLOCK_BYTES, packed);
+      if (size > entry.capacity) { //a block which has moved once is likely to grow again
+        entry.capacity = entry.loc < 0 ? size : size + size / 4;
+        entry.loc = end;
+        end += entry.capacity;
+      }
+      entry.size = size;
+      entry.checksum = crc32c(packed, size);
+      file.write(entry.loc, packed, size);
+      table.write(HEADER_SIZE + b * (long long) sizeof(Entry), &entry, sizeof(Entry));
+    });
+    table.write(0, &count, HEADER_SIZE);
+    delete[] packed;
+    delete[] raw;
+  }
+
+  void dropBlocks() { //under the exclusive latch
+    blocks.forEach([](int, Block *block) {
+      delete block;
+    });
+    blocks.clear();
+    cacheCount = 0;
+  }
+
+public:
+  explicit PackedStorage(const string &file_name) : file(file_name), table(file_name + "_blocks"),
+                                                    tail(file_name + "_tail") {
+    readTable();
+  }
+
+  ~PackedStorage() {
+    writeBack();
+    dropBlocks();
+  }
+
+  void checkCache() { //blocks holding images stay
+    versioned.collect();
+    if (cacheCount > MAX_CACHE_COUNT) {
+      std::lock_guard guard(latch);
+      writeBack();
+      cacheCount = 0;
+      blocks.forEach([this](int b, Block *block) {
+        if (block->pinned()) {
+          cacheCount += BLOCK;
+        } else {
+          blocks.store(b, nullptr, std::memory_order_relaxed);
+          delete block;
+        }
+      });
+    }
+  }
+
+  //write all dirty blocks back, so that the files alone hold the storage
+  void checkpoint() {
+    std::lock_guard guard(latch);
+    writeBack();
+  }
+
+  //drop the cache without writing it back and read the table again, after the files have changed underneath.
+  //no reader may be running
+  void reload() {
+    std::lock_guard guard(latch);
+    dropBlocks();
+    versioned.clear();
+    readTable();
+  }
+
+  int write(const T &t) {
+    std::lock_guard guard(latch);
+    int index = count;
+    int b = index / BLOCK;
+    Block *block = index % BLOCK == 0 ? newBlock(b) : load(b);
+    block->records[index % BLOCK].data = t;
+    block->dirty = true;
+    if (++count % BLOCK == 0) { //compressed once written back
+      entries.push_back({-1, 0, 0, 0});
+    }
+    return index;
+  }
+
+  //load the blocks of the records at the given indices which are not cached with a batch of reads, so that the
+  //device works on all of them at once and get then finds them in the cache. may run alongside get like load does
+  void fetch(const list<int> &indices) {
+    int size = indices.size();
+    IoRequest requests[BATCH];
+    int loading[BATCH];
+    std::lock_guard guard(latch);
+    for (int first = 0; first < size; first += BATCH) {
+      int n = 0;
+      for (int i = first; i < size && i < first + BATCH; i++) {
+        int b = indices[i] / BLOCK;
+        bool duplicate = false;
+        for (int j = 0; j < n; j++) {
+          duplicate |= loading[j] == b;
+        }
+        if (indices[i] < 0 || duplicate || blocks.find(b, std::memory_order_relaxed)) {
+          continue;
+        }
+        if (b >= (int) entries.size()) { //the last block is read plain
+          load(b);
+          continue;
+        }
+        loading[n] = b;
+        requests[n] = {entries[b].loc, new char[entries[b].size], entries[b].size, 0};
+        n++;
+      }
+      file.readAll(requests, n);
+      for (int j = 0; j < n; j++) {
+        decode(loading[j], static_cast<char *>(requests[j].ptr));
+        delete[] static_cast<char *>(requests[j].ptr);
+      }
+    }
+  }
+
+  //check every block in file and every record in tail against its checksum. the blocks must have been written
+  //back. return the bad records
+  int scrub() {
+    std::lock_guard guard(latch);
+    S *raw = new S[BLOCK];
+    int bad = 0;
+    for (int b = 0; b < (int) entries.size(); b++) {
+      char *packed = new char[entries[b].size];
+      file.read(entries[b].loc, packed, entries[b].size);
+      if (!unpack(entries[b], packed, raw)) {
+        file.stats.corrupt++;
+        bad += BLOCK;
+      }
+      delete[] packed;
+    }
+    delete[] raw;
+    int n = count % BLOCK;
+    list<bool> free;
+    for (int i = 0; i < n; i++) {
+      free.push_back(false);
+    }
+    return bad + scrubRecords<S>(tail, 0, n, free);
+  }
+
+  //may run in many threads alongside one thread which changes the storage
+  //a snapshot reader gets the image of the record as of its epoch
+  T *get(int index, bool dirty) {
+    int b = index / BLOCK;
+    if (Snapshot::reading()) {
+      while (true) {
+        {
+          std::shared_lock guard(latch);
+          Block *block = blocks.find(b);
+          if (block) {
+            std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+            Cache *cache = &block->records[index % BLOCK];
+            bool first;
+            T *ret = cache->versions.read(cache->data, first);
+            if (first) {
+              versioned.add(cache);
+            }
+            return ret;
+          }
+        }
+        std::lock_guard guard(latch);
+        load(b);
+      }
+    }
+    Block *block = blocks.find(b);
+    if (block) {
+      std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+    } else {
+      std::lock_guard guard(latch);
+      block = load(b);
+    }
+    Cache *cache = &block->records[index % BLOCK];
+    if (dirty) {
+      if (cache->versions.write(cache->data)) {
+        versioned.add(cache);
+      }
+      block->dirty = true;
+    }
+    return &cache->data;
+  }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef TICKETSYSTEM2024_PAGE_LOG_HPP
+#define TICKETSYSTEM2024_PAGE_LOG_HPP
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <string>
+#include "../data_structure/map.hpp"
+
+//pages of one file as they were when a named snapshot was taken. a page is saved when it is first overwritten
+//after that, so the log grows with the pages changed, not with the file. see NamedSnapshots
+//layout: file length at the snapshot, then records of a page number and the page
+class PageLog {
+  std::string path;
+  int fd = -1; //opened on first use
+  long long length = 0;
+  map<long long, long long> pages; //page number to offset of the record
+  long long end = sizeof(long long);
+
+  bool open() {
+    if (fd >= 0) {
+      return true;
+    }
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    return fd >= 0;
+  }
+
+public:
+  static constexpr int PAGE_SIZE = 4096;
+  static constexpr int RECORD_SIZE = sizeof(long long) + PAGE_SIZE;
+
+  //start a new log for a file of the given length, or read an existing one if length < 0
+  PageLog(const std::string &path, long long length) : path(path) {
+    if (!open()) {
+      return;
+    }
+    if (length >= 0) {
+      this->length = length;
+      ftruncate(fd, 0);
+      pwrite(fd, &this->length, sizeof(long long), 0);
+      return;
+    }
+    pread(fd, &this->length, sizeof(long long), 0);
+    long long page;
+    while (pread(fd, &page, sizeof(long long), end) == sizeof(long long)) {
+      pages[page] = end;
+      end += RECORD_SIZE;
+    }
+  }
+
+  PageLog(const PageLog &) = delete;
+
+  PageLog &operator=(const PageLog &) = delete;
+
+  ~PageLog() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  long long fileLength() const {
+    return length;
+  }
+
+  const map<long long, long long> &saved() const {
+    return pages;
+  }
+
+  bool has(long long page) const {
+    return pages.find(page) != pages.cend();
+  }
+
+  void save(long long page, const char *data) {
+    if (has(page) || !open()) {
+      return;
+    }
+    pwrite(fd, &page, sizeof(long long), end);
+    pwrite(fd, data, PAGE_SIZE, end + sizeof(long long));
+    pages[page] = end;
+    end += RECORD_SIZE;
+  }
+
+  void load(long long page, char *data) {
+    auto it = pages.find(page);
+    if (it == pages.end() || !open() || pread(fd, data, PAGE_SIZE, it->second + sizeof(long long)) != PAGE_SIZE) {
+      memset(data, 0, PAGE_SIZE);
+    }
+  }
+
+  //save the pages of [loc, loc + size) in file fd which existed at the snapshot, before they are overwritten
+  void preserve(int file, long long loc, long long size) {
+    char data[PAGE_SIZE];
+    for (long long page = loc / PAGE_SIZE; page * PAGE_SIZE < loc + size && page * PAGE_SIZE < length; page++) {
+      if (!has(page)) {
+        long long n = pread(file, data, PAGE_SIZE, page * PAGE_SIZE);
+        memset(data + (n > 0 ? n : 0), 0, PAGE_SIZE - (n > 0 ? n : 0));
+        save(page, data);
+      }
+    }
+  }
+};
+
+#endif
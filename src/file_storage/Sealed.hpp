@@ -0,0 +1,51 @@
+#ifndef TICKETSYSTEM2024_SEALED_HPP
+#define TICKETSYSTEM2024_SEALED_HPP
+
+#include <cstddef>
+#include <cstring>
+#include "File.hpp"
+#include "../util/Crc32c.hpp"
+#include "../data_structure/list.hpp"
+
+//a record as the stores keep it in file: the record followed by its checksum, so that a torn or decayed write is
+//found when the record is read back instead of being taken for data
+template<typename T>
+struct Sealed {
+  T data;
+  unsigned checksum;
+
+  void seal() {
+    checksum = crc32c(&data, sizeof(T));
+  }
+
+  bool intact() const {
+    return checksum == crc32c(&data, sizeof(T));
+  }
+};
+
+//check the count records of type Sealed<T> from loc on against their checksums, reading the file in large chunks
+//so that it goes at disk bandwidth. the records where free is true hold no record. return the bad records
+template<typename T>
+int scrubRecords(File &file, long long loc, int count, const list<bool> &free) {
+  constexpr int SIZE = sizeof(Sealed<T>);
+  constexpr int CHUNK = (1 << 20) / SIZE > 0 ? (1 << 20) / SIZE : 1; //records read at once
+  char *buffer = new char[(long long) CHUNK * SIZE];
+  int bad = 0;
+  for (int first = 0; first < count; first += CHUNK) {
+    int n = count - first < CHUNK ? count - first : CHUNK;
+    file.read(loc + (long long) first * SIZE, buffer, n * SIZE);
+    for (int i = 0; i < n; i++) {
+      const char *record = buffer + (long long) i * SIZE;
+      unsigned checksum;
+      memcpy(&checksum, record + offsetof(Sealed<T>, checksum), sizeof(unsigned));
+      if (!free[first + i] && checksum != crc32c(record, sizeof(T))) {
+        bad++;
+      }
+    }
+  }
+  delete[] buffer;
+  file.stats.corrupt += bad;
+  return bad;
+}
+
+#endif
@@ -2,8 +2,15 @@
 #define TICKETSYSTEM2024_SUPER_FILE_STORAGE_HPP
 
 #include <fstream>
-#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include "File.hpp"
+#include "Sealed.hpp"
+#include "FrameDirectory.hpp"
 #include "../util/Exceptions.hpp"
+#include "../util/OptimisticLock.hpp"
+#include "../util/Snapshot.hpp"
+#include "../data_structure/list.hpp"
 
 using std::string;
 using std::fstream;
@@ -11,19 +18,25 @@ using std::ifstream;
 using std::ofstream;
 
 //file storage which saves all data in cache
-//use linear cache. for big cache size. (in fact, it's not a cache)
-template<class T, class INFO, int MAX_SIZE>
+//use a directory of frames by index, which grows with the file. for big cache size. (in fact, it's not a cache)
+//get may run in many threads alongside one thread which changes the storage. so may checkCache for snapshot readers,
+//which are handed images of the records instead (see Snapshot), but not for other readers
+template<class T, class INFO>
 class SuperFileStorage {
-  struct Cache {
-    T data;
+  struct Cache : Sealed<T> { //data comes first, so that it can be turned back into its frame
     bool dirty = false;
+    OptimisticLock lock;
+    Versions<T> versions;
   };
-  static constexpr int T_SIZE = sizeof(T);
+  static constexpr int RECORD_SIZE = sizeof(Sealed<T>); //in file
   static constexpr int INFO_SIZE = sizeof(INFO);
   static constexpr int INT_SIZE = sizeof(int);
-  fstream file;
-  string fileName;
-  Cache* cacheMap[MAX_SIZE]{nullptr}; //a map from index to cache
+  static constexpr int BATCH = 64; //records written back at once
+  File file;
+  FrameDirectory<Cache> cacheMap; //a map from index to cache
+  list<Cache *> retired; //removed frames which readers may still look at
+  VersionedFrames<Cache> versioned;
+  std::shared_mutex latch; //guards loading and file. snapshot readers hold it shared while they resolve an image
   int empty;
 
   int getEmpty() {
@@ -35,97 +48,235 @@ class SuperFileStorage {
   }
 
   static int getIndex(int loc) {
-    return (loc - INFO_SIZE - INT_SIZE) / T_SIZE;
+    return (loc - INFO_SIZE - INT_SIZE) / RECORD_SIZE;
   }
 
   static int getLoc(int index) {
-    return index * T_SIZE + INFO_SIZE + INT_SIZE;
+    return index * RECORD_SIZE + INFO_SIZE + INT_SIZE;
   }
+
+  Cache *load(int index) { //under the exclusive latch
+    Cache *cache = cacheMap.find(index, std::memory_order_relaxed);
+    if (!cache) { //another reader may have loaded it meanwhile
+      cache = new Cache();
+      file.read(getLoc(index), static_cast<Sealed<T> *>(cache), RECORD_SIZE);
+      file.stats.misses++;
+      if (!cache->intact()) {
+        file.stats.corrupt++;
+      }
+      cacheMap.store(index, cache);
+    }
+    return cache;
+  }
+
+  //keep the record for snapshot readers before it changes
+  void beforeWrite(Cache *cache) {
+    if (cache->versions.write(cache->data)) {
+      versioned.add(cache);
+    }
+  }
+
+  //whether a frame must stay in place since snapshot readers may resolve it
+  static bool pinned(Cache *cache) {
+    return Snapshot::active() || !cache->versions.empty();
+  }
+
   //store pointer to first empty just after info len.
   //empty except end has pointer to next empty; check EOF to determine whether at end. (so don't store anything after this)
 public:
   INFO info;
 
-  SuperFileStorage(const INFO &initInfo, const string &file_name) : fileName("storage/" + file_name + ".dat") {
+  SuperFileStorage(const INFO &initInfo, const string &file_name) : file(file_name) {
     newFile(initInfo);
-    file.open(fileName, std::ios::in | std::ios::out | std::ios::binary);
-    file.read(reinterpret_cast<char *>(&info), INFO_SIZE);
-    file.read(reinterpret_cast<char *>(&empty), INT_SIZE);
+    file.read(0, &info, INFO_SIZE);
+    file.read(INFO_SIZE, &empty, INT_SIZE);
   }
 
   ~SuperFileStorage() {
-    file.seekp(0);
-    file.write(reinterpret_cast<const char *>(&info), INFO_SIZE);
-    file.write(reinterpret_cast<const char *>(&empty), INT_SIZE);
-    for(int i= 0; i < MAX_SIZE; i++) {
-      if(cacheMap[i]) {
-        if(cacheMap[i]->dirty) {
-          file.seekp(getLoc(i));
-          file.write(reinterpret_cast<const char *>(&cacheMap[i]->data), T_SIZE);
-        }
-        delete cacheMap[i];
+    file.write(0, &info, INFO_SIZE);
+    file.write(INFO_SIZE, &empty, INT_SIZE);
+    cacheMap.forEach([this](int i, Cache *cache) {
+      if(cache->dirty) {
+        cache->seal();
+        file.write(getLoc(i), static_cast<Sealed<T> *>(cache), RECORD_SIZE);
       }
+      delete cache;
+    });
+    for (Cache *cache: retired) {
+      delete cache;
+    }
+  }
+
+  //write the header and all dirty frames back, so that the file alone holds the storage
+  void checkpoint() {
+    std::lock_guard guard(latch);
+    file.write(0, &info, INFO_SIZE);
+    file.write(INFO_SIZE, &empty, INT_SIZE);
+    IoRequest requests[BATCH];
+    int count = 0;
+    cacheMap.forEach([&](int i, Cache *cache) {
+      if (cache->dirty) {
+        cache->seal();
+        requests[count++] = {getLoc(i), static_cast<Sealed<T> *>(cache), RECORD_SIZE, 0};
+        cache->dirty = false;
+      }
+      if (count == BATCH) {
+        file.writeAll(requests, count);
+        count = 0;
+      }
+    });
+    file.writeAll(requests, count);
+  }
+
+  //drop the cache without writing it back and read the header again, after the file has changed underneath.
+  //no reader may be running
+  void reload() {
+    std::lock_guard guard(latch);
+    cacheMap.forEach([](int, Cache *cache) {
+      delete cache;
+    });
+    cacheMap.clear();
+    for (Cache *cache: retired) {
+      delete cache;
     }
-    file.close();
+    retired.clear();
+    versioned.clear();
+    file.read(0, &info, INFO_SIZE);
+    file.read(INFO_SIZE, &empty, INT_SIZE);
+  }
+
+  void checkCache() { //nothing is evicted. only drop images and free removed frames
+    versioned.collect();
+    for (Cache *cache: retired) {
+      delete cache;
+    }
+    retired.clear();
+  }
+
+  //check every record in file against its checksum, skipping the free slots. the frames must have been written
+  //back. return the number of bad records
+  int scrub() {
+    std::lock_guard guard(latch);
+    int count = (int) ((file.size() - INFO_SIZE - INT_SIZE) / RECORD_SIZE);
+    list<bool> free;
+    for (int i = 0; i < count; i++) {
+      free.push_back(false);
+    }
+    int loc = empty;
+    for (int i = 0; i < count && loc >= INFO_SIZE + INT_SIZE && getIndex(loc) < count; i++) { //the free list
+      free[getIndex(loc)] = true;
+      file.read(loc, &loc, INT_SIZE);
+    }
+    return scrubRecords<T>(file, getLoc(0), count, free);
   }
 
   void newFile(const INFO &initInfo) {
-    if (std::filesystem::exists(fileName)) {
+    if (file.size() > 0) {
       return;
     }
-    std::filesystem::create_directory("storage");
-    file.open(fileName, std::ios::out | std::ios::binary);
     int initEmpty = INFO_SIZE + INT_SIZE;
-    file.write(reinterpret_cast<const char *>(&initInfo), INFO_SIZE);
-    file.write(reinterpret_cast<const char *>(&initEmpty), INT_SIZE);
-    file.close();
+    file.write(0, &initInfo, INFO_SIZE);
+    file.write(INFO_SIZE, &initEmpty, INT_SIZE);
   }
 
   int add(const T &t) {
+    std::lock_guard guard(latch);
     int loc = getEmpty();
-    file.seekg(loc);
     int nxt;
-    if (file.peek() == EOF) {
-      nxt = loc + T_SIZE;
-      file.clear(); //clear EOF flag
+    if (loc >= file.size()) {
+      nxt = loc + RECORD_SIZE;
     } else {
-      file.read(reinterpret_cast<char *>(&nxt), INT_SIZE);
+      file.read(loc, &nxt, INT_SIZE);
     }
-    file.seekp(loc);
-    file.write(reinterpret_cast<const char *>(&t), T_SIZE);
+    Sealed<T> record{t, 0};
+    record.seal();
+    file.write(loc, &record, RECORD_SIZE);
     setEmpty(nxt);
     int index = getIndex(loc);
-    if(index < MAX_SIZE) {
-      cacheMap[index] = new Cache();
-      cacheMap[index]->data = t;
-    } else {
-      throw FileSizeExceeded();
+    Cache *old = cacheMap.find(index, std::memory_order_relaxed);
+    if (old && pinned(old)) { //the frame of the removed record is kept for snapshot readers
+      beforeWrite(old);
+      old->data = t;
+      old->dirty = false;
+      old->lock.revive();
+      return index;
+    }
+    Cache *cache = new Cache();
+    cache->data = t;
+    cacheMap.store(index, cache);
+    if (old) { //a reader loaded the free slot after it was removed
+      old->lock.markObsolete();
+      retired.push_back(old);
     }
     return index;
   }
 
+  //a snapshot reader gets the image of the record as of its epoch
   T *get(int index, bool dirty) {
-    if(!cacheMap[index]) {
-      cacheMap[index] = new Cache();
-      file.seekg(getLoc(index));
-      file.read(reinterpret_cast<char *>(&cacheMap[index]->data), T_SIZE);
+    if (Snapshot::reading()) {
+      while (true) {
+        {
+          std::shared_lock guard(latch);
+          Cache *cache = cacheMap.find(index);
+          if (cache) {
+            std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+            bool first;
+            T *ret = cache->versions.read(cache->data, first);
+            if (first) {
+              versioned.add(cache);
+            }
+            return ret;
+          }
+        }
+        std::lock_guard guard(latch);
+        load(index);
+      }
+    }
+    Cache *cache = cacheMap.find(index);
+    if(cache) {
+      std::atomic_ref(file.stats.hits).fetch_add(1, std::memory_order_relaxed);
+    } else {
+      std::lock_guard guard(latch);
+      cache = load(index);
     }
     if(dirty) {
-      cacheMap[index]->dirty = true;
+      beforeWrite(cache);
+      cache->dirty = true;
     }
-    return &cacheMap[index]->data;
+    return &cache->data;
+  }
+
+  //mark data returned by get as dirty and return its latch
+  OptimisticLock &modify(T *data) {
+    Cache *cache = reinterpret_cast<Cache *>(data);
+    beforeWrite(cache);
+    cache->dirty = true;
+    return cache->lock;
+  }
+
+  static OptimisticLock &lockOf(T *data) {
+    return reinterpret_cast<Cache *>(data)->lock;
   }
 
   void remove(int index) {
-    if(cacheMap[index]) {
-      delete cacheMap[index];
-      cacheMap[index] = nullptr;
+    std::lock_guard guard(latch);
+    Cache *cache = cacheMap.find(index, std::memory_order_relaxed);
+    if (!cache && Snapshot::active()) { //the record is about to be overwritten in file
+      cache = load(index);
+    }
+    if (cache && pinned(cache)) { //snapshot readers may still resolve the record, so the frame stays
+      beforeWrite(cache);
+      cache->lock.markObsolete();
+      cache->dirty = false;
+    } else if(cache) {
+      cacheMap.store(index, nullptr, std::memory_order_relaxed);
+      cache->lock.markObsolete();
+      retired.push_back(cache);
     }
     int nxt = getEmpty();
     int loc = getLoc(index);
     setEmpty(loc);
-    file.seekp(loc);
-    file.write(reinterpret_cast<const char *>(&nxt), INT_SIZE);
+    file.write(loc, &nxt, INT_SIZE);
   }
 };
 
@@ -0,0 +1,355 @@
+#ifndef TICKETSYSTEM2024_PERSISTENT_HASH_MAP_HPP
+#define TICKETSYSTEM2024_PERSISTENT_HASH_MAP_HPP
+
+#include "../util/Util.hpp"
+#include "../util/Hash.hpp"
+#include "../file_storage/FileStorage.hpp"
+#include "../file_storage/SuperFileStorage.hpp"
+#include "../file_storage/CountingBloomFilter.hpp"
+#include "../util/OptimisticLock.hpp"
+#include "../util/Snapshot.hpp"
+#include <mutex>
+
+//extendible hashing on T::index, for maps which are only accessed by exact key. same contract as PersistentMap
+//except that there is no order. the directory is kept in memory, so a lookup reads one bucket of half a page.
+//a full bucket splits in two by one more bit of the hash, doubling the directory if it has no such bit yet.
+//buckets are never merged. a counting bloom filter of 1 << FILTER_LOG_SIZE counters answers most misses of the writer
+//without reading a bucket
+template<typename T, int BUCKET_CACHE_SIZE = 0, int FILTER_LOG_SIZE = 20>
+class PersistentHashMap {
+  typedef T::INDEX INDEX;
+
+  static constexpr int PAGE_ENTRIES = 1024;
+  static constexpr int BUCKET_BYTES = 2048; //buckets are not page aligned, so a larger one would often span two pages
+  static constexpr int BUCKET_SIZE = (BUCKET_BYTES - 2 * (int) sizeof(int)) / (int) sizeof(T);
+
+  static_assert(BUCKET_SIZE >= 4, "T is too large for a bucket");
+
+  struct DirectoryPage {
+    int buckets[PAGE_ENTRIES];
+  };
+
+  struct Bucket {
+    int depth = 0; //the number of hash bits all records in the bucket share
+    int size = 0;
+    T data[BUCKET_SIZE];
+
+    int find(const INDEX &val) const {
+      for (int i = 0; i < size; i++) {
+        if (data[i].index() == val) {
+          return i;
+        }
+      }
+      return -1;
+    }
+  };
+
+  class iterator {
+    PersistentHashMap *map;
+    Bucket *bucket;
+    int pos;
+
+  public:
+    iterator() = default;
+
+    iterator(PersistentHashMap *map, Bucket *bucket, int pos) : map(map), bucket(bucket), pos(pos) {}
+
+    T &operator*() {
+      return bucket->data[pos];
+    }
+
+    T *operator->() {
+      return &bucket->data[pos];
+    }
+
+    //set the bucket as dirty. it is latched until the next insert or erase, or checkCache
+    void markDirty() {
+      map->latch(map->bucketStorage.modify(bucket));
+    }
+  };
+
+  static constexpr unsigned long long FILTER_SEED = 0x9e3779b97f4a7c15ULL; //apart from the directory hash
+
+  int depth; //global depth: the directory has 1 << depth slots
+  OptimisticLock directoryLock; //latched while the directory or depth changes
+  pair<int, int> published; //depth and length, as seen by snapshot readers
+  Versions<pair<int, int>> publishedVersions;
+  std::mutex writeLatch; //writers are serialized. readers are not
+  list<OptimisticLock *> latched; //held by the writer. iterators may latch any number of buckets
+  SuperFileStorage<DirectoryPage, int> directoryStorage; //int is depth
+  FileStorage<Bucket, int, BUCKET_CACHE_SIZE> bucketStorage; //int is the size
+  CountingBloomFilter<FILTER_LOG_SIZE> filter; //of the current keys, so snapshot readers may not use it
+
+  static unsigned long long filterHash(const INDEX &val) {
+    return hashBytes(&val, sizeof(INDEX), FILTER_SEED);
+  }
+
+  void rebuildFilter() { //from all buckets, for files written before the filter existed
+    for (int slot = 0; slot < (1 << depth); slot++) {
+      Bucket *bucket = bucketStorage.get(bucketAt(slot), false);
+      if (slot < (1 << bucket->depth)) { //the first slot pointing to the bucket
+        for (int i = 0; i < bucket->size; i++) {
+          filter.add(filterHash(bucket->data[i].index()));
+        }
+      }
+      bucketStorage.checkCache();
+    }
+  }
+
+  //a snapshot reader sees the directory as of its epoch
+  int currentDepth() {
+    if (Snapshot::reading()) {
+      bool first;
+      return publishedVersions.read(published, first)->first;
+    }
+    return depth;
+  }
+
+  int bucketAt(int slot) {
+    return directoryStorage.get(slot / PAGE_ENTRIES, false)->buckets[slot % PAGE_ENTRIES];
+  }
+
+  Bucket *bucketOf(const INDEX &val) {
+    return bucketStorage.get(bucketAt(hashOf(val) & ((1ULL << currentDepth()) - 1)), false);
+  }
+
+  void publish() { //called at the end of every write
+    if (published.first != depth || published.second != length) {
+      publishedVersions.write(published);
+      published = {depth, length};
+    }
+  }
+
+  //writers latch every page and bucket right before changing it, and release all latches when the operation ends
+  void latch(OptimisticLock &lock) {
+    for (size_t i = 0; i < latched.size(); i++) {
+      if (latched[i] == &lock) {
+        return;
+      }
+    }
+    lock.writeLock();
+    latched.push_back(&lock);
+  }
+
+  void unlatch() {
+    while (!latched.empty()) {
+      latched.back()->writeUnlock();
+      latched.pop_back();
+    }
+  }
+
+  void grow() { //double the directory. the new half points to the same buckets as the old one
+    int count = 1 << depth;
+    if (count < PAGE_ENTRIES) {
+      DirectoryPage *page = directoryStorage.get(0, false);
+      latch(directoryStorage.modify(page));
+      memcpy(page->buckets + count, page->buckets, count * sizeof(int));
+    } else {
+      int pages = count / PAGE_ENTRIES;
+      for (int i = 0; i < pages; i++) {
+        DirectoryPage copy = *directoryStorage.get(i, false);
+        directoryStorage.add(copy); //pages are never removed, so they are added in order
+      }
+    }
+    depth++;
+  }
+
+  void setBucket(int slot, int bucket) {
+    DirectoryPage *page = directoryStorage.get(slot / PAGE_ENTRIES, false);
+    latch(directoryStorage.modify(page));
+    page->buckets[slot % PAGE_ENTRIES] = bucket;
+  }
+
+  //split the full bucket at slot by the next bit of the hash
+  void split(int slot, Bucket *bucket) {
+    latch(directoryLock);
+    if (bucket->depth == depth) {
+      grow();
+    }
+    latch(bucketStorage.modify(bucket));
+    int bit = 1 << bucket->depth;
+    Bucket sibling;
+    sibling.depth = bucket->depth + 1;
+    int kept = 0;
+    for (int i = 0; i < bucket->size; i++) {
+      if (hashOf(bucket->data[i].index()) & bit) {
+        sibling.data[sibling.size++] = bucket->data[i];
+      } else {
+        bucket->data[kept++] = bucket->data[i];
+      }
+    }
+    bucket->size = kept;
+    bucket->depth++;
+    int siblingIndex = bucketStorage.add(sibling);
+    for (int s = (slot & (bit - 1)) | bit; s < (1 << depth); s += bit << 1) {
+      setBucket(s, siblingIndex);
+    }
+  }
+
+public:
+  int length;
+
+  explicit PersistentHashMap(std::string file_name) : directoryStorage(-1, file_name + "_directory"),
+                                                      bucketStorage(0, file_name + "_bucket"),
+                                                      filter(file_name + "_filter") {
+    if (directoryStorage.info == -1) {
+      DirectoryPage first{};
+      first.buckets[0] = bucketStorage.add(Bucket());
+      directoryStorage.add(first);
+      depth = 0;
+    } else {
+      depth = directoryStorage.info;
+    }
+    length = bucketStorage.info;
+    published = {depth, length};
+    if (!filter.load() && length > 0) {
+      rebuildFilter();
+    }
+  }
+
+  ~PersistentHashMap() {
+    directoryStorage.info = depth;
+    bucketStorage.info = length;
+  }
+
+  //write the whole map back to its files. see NamedSnapshots
+  void checkpoint() {
+    unlatch();
+    directoryStorage.info = depth;
+    bucketStorage.info = length;
+    directoryStorage.checkpoint();
+    bucketStorage.checkpoint();
+    filter.save();
+  }
+
+  //check the files against their checksums after checkpoint. return the number of bad records
+  int scrub() {
+    return directoryStorage.scrub() + bucketStorage.scrub();
+  }
+
+  //read the map again after its files have changed underneath. no reader may be running
+  void reload() {
+    unlatch();
+    directoryStorage.reload();
+    bucketStorage.reload();
+    depth = directoryStorage.info;
+    length = bucketStorage.info;
+    published = {depth, length};
+    publishedVersions.collect(Snapshot::horizon());
+    if (!filter.load() && length > 0) {
+      rebuildFilter();
+    }
+  }
+
+  void checkCache() { //must not run alongside readers other than snapshot readers
+    unlatch();
+    publishedVersions.collect(Snapshot::horizon());
+    directoryStorage.checkCache();
+    bucketStorage.checkCache();
+  }
+
+  bool empty() {
+    return length == 0;
+  }
+
+  int size() { //a snapshot reader gets the length as of its epoch
+    if (Snapshot::reading()) {
+      bool first;
+      return publishedVersions.read(published, first)->second;
+    }
+    return length;
+  }
+
+  bool insert(const T &val) {
+    std::lock_guard guard(writeLatch);
+    INDEX index = val.index();
+    unsigned long long hash = hashOf(index);
+    bool ret;
+    while (true) {
+      int slot = hash & ((1ULL << depth) - 1);
+      Bucket *bucket = bucketStorage.get(bucketAt(slot), false);
+      if (bucket->find(index) >= 0) {
+        ret = false;
+        break;
+      }
+      if (bucket->size < BUCKET_SIZE) {
+        latch(bucketStorage.modify(bucket));
+        bucket->data[bucket->size++] = val;
+        length++;
+        filter.add(filterHash(index));
+        ret = true;
+        break;
+      }
+      split(slot, bucket);
+    }
+    publish();
+    unlatch();
+    return ret;
+  }
+
+  bool erase(const INDEX &val) {
+    std::lock_guard guard(writeLatch);
+    unsigned long long check = filterHash(val);
+    int p = -1;
+    if (filter.mayContain(check)) {
+      Bucket *bucket = bucketOf(val);
+      p = bucket->find(val);
+      if (p >= 0) {
+        latch(bucketStorage.modify(bucket));
+        bucket->data[p] = bucket->data[--bucket->size];
+        length--;
+        filter.remove(check);
+      }
+    }
+    publish();
+    unlatch();
+    return p >= 0;
+  }
+
+  Optional<iterator> get(const INDEX &val) {
+    if (!Snapshot::reading() && !filter.mayContain(filterHash(val))) {
+      return {};
+    }
+    Bucket *bucket = bucketOf(val);
+    int p = bucket->find(val);
+    return p >= 0 ? Optional<iterator>(iterator(this, bucket, p)) : Optional<iterator>();
+  }
+
+  //point lookup which may run in many threads alongside one writer. copy the record into result
+  bool read(const INDEX &val, T &result) {
+    if (Snapshot::reading()) { //images never change
+      auto it = get(val);
+      if (it.present) {
+        result = *it.value;
+      }
+      return it.present;
+    }
+    unsigned long long hash = hashOf(val);
+    while (true) {
+      unsigned long long version;
+      if (!directoryLock.readLock(version)) {
+        continue;
+      }
+      Bucket *bucket = bucketStorage.get(bucketAt(hash & ((1ULL << depth) - 1)), false);
+      unsigned long long bucketVersion;
+      if (!bucketStorage.lockOf(bucket).readLock(bucketVersion) || !directoryLock.validate(version)) {
+        continue;
+      }
+      int size = bucket->size < 0 ? 0 : bucket->size > BUCKET_SIZE ? BUCKET_SIZE : bucket->size; //may be torn
+      int p = -1;
+      for (int i = 0; i < size && p < 0; i++) {
+        if (bucket->data[i].index() == val) {
+          p = i;
+        }
+      }
+      if (p >= 0) {
+        result = bucket->data[p];
+      }
+      if (bucketStorage.lockOf(bucket).validate(bucketVersion)) {
+        return p >= 0;
+      }
+    }
+  }
+};
+
+#endif
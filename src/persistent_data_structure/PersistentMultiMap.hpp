@@ -6,10 +6,15 @@
 #define TICKETSYSTEM2024_PERSISTENT_MULTI_MAP_HPP
 
 #include "../util/Util.hpp"
+#include "../util/Hash.hpp"
 #include "../file_storage/FileStorage.hpp"
 #include "../file_storage/SuperFileStorage.hpp"
+#include "../util/OptimisticLock.hpp"
+#include "../util/Snapshot.hpp"
+#include "Separators.hpp"
+#include <mutex>
 
-template<typename T0, int MAX_TREE_SIZE = 1000>
+template<typename T0, int LEAF_CACHE_SIZE = 0>
 class PersistentMultiMap {
   //use T0+int as key and value. new elements are always inserted at end or first
   //if you want other order, use persistent set instead
@@ -20,6 +25,11 @@ class PersistentMultiMap {
     T0::INDEX index;
     int tick;
     auto operator<=>(const INDEX &rhs) const = default;
+
+    friend void encodeKey(unsigned char *&out, const INDEX &key) {
+      encodeKey(out, key.index);
+      encodeKey(out, key.tick);
+    }
   };
 
   struct T {
@@ -31,17 +41,26 @@ class PersistentMultiMap {
     }
   };
 
-  static constexpr int SIZE_1 = 1000 / sizeof(T) * 2;
+  static constexpr int SIZE_1 = 256; //children of a tree node at most. most nodes run out of separator bytes first
   static constexpr int SIZE_2 = 1000 / sizeof(INDEX) * 2;
+  static constexpr int SEPARATOR_BYTES = 2048;
 
   static_assert(SIZE_1 >= 4 && SIZE_1 % 2 == 0, "SIZE_1 must be even and at least 4");
   static_assert(SIZE_2 >= 4 && SIZE_2 % 2 == 0, "SIZE_2 must be even and at least 4");
 
+  typedef Separators<INDEX, SIZE_1 - 1, SEPARATOR_BYTES> NodeSeparators;
+  typedef NodeSeparators::Key Key;
+
+  static constexpr int PREFETCH_LEAVES = 8; //leaves kept on their way ahead of a long scan at most
+  static constexpr int MAX_HEIGHT = 16;
+
   class iterator {
     PersistentMultiMap *set;
     int leafPos;
     int pos;
     LeafNode *leaf;
+    int ahead = 0; //leaves after this one which were hinted
+    int window = 1; //leaves to keep hinted. it grows as the scan goes on, since most scans end within a leaf or two
 
   public:
     iterator() = default;
@@ -58,6 +77,11 @@ class PersistentMultiMap {
         leafPos = leaf->next;
         leaf = set->getPtr(leafPos, false).leafNode();
         pos = 0;
+        if (leaf && --ahead <= window / 2) { //the scan goes on, so read the next leaves while this one is used
+          window = window * 2 < PREFETCH_LEAVES ? window * 2 : PREFETCH_LEAVES;
+          set->prefetch(leaf, ahead < 0 ? 0 : ahead, window);
+          ahead = window;
+        }
       }
       return *this;
     }
@@ -94,8 +118,9 @@ class PersistentMultiMap {
       return leaf == nullptr;
     }
 
-    void markDirty() { //set current node as dirty
-      set->getPtr(leafPos, true);
+    //set current node as dirty. the node is latched until the next insert or erase, or checkCache
+    void markDirty() {
+      set->modify(leaf);
     }
   };
 
@@ -118,46 +143,46 @@ class PersistentMultiMap {
       return static_cast<LeafNode *>(ptr);
     }
 
-    bool insert(PersistentMultiMap *set, const T &val, TreeNode *parent, int parentPos) {
+    bool insert(PersistentMultiMap *set, const T &val, const Key &key, TreeNode *parent, int parentPos) {
       if (isLeaf) {
         return leafNode()->insert(set, val, parent, parentPos);
       } else {
-        return treeNode()->insert(set, val, parent, parentPos);
+        return treeNode()->insert(set, val, key, parent, parentPos);
       }
     }
 
-    bool erase(PersistentMultiMap *set, const INDEX &val, TreeNode *parent, int parentPos) {
+    bool erase(PersistentMultiMap *set, const INDEX &val, const Key &key, TreeNode *parent, int parentPos) {
       if (isLeaf) {
         return leafNode()->erase(set, val, parent, parentPos);
       } else {
-        return treeNode()->erase(set, val, parent, parentPos);
+        return treeNode()->erase(set, val, key, parent, parentPos);
       }
     }
 
-    iterator find(PersistentMultiMap *set, const INDEX &val, int loc) {
+    iterator find(PersistentMultiMap *set, const INDEX &val, const Key &key, int loc) {
       if (isLeaf) {
         return leafNode()->find(set, val, loc);
       } else {
-        return treeNode()->find(set, val, loc);
+        return treeNode()->find(set, val, key, loc);
       }
     }
   };
 
   struct TreeNode {
     int size = 0; //the number of children
-    INDEX index[SIZE_1 - 1];
     int children[SIZE_1];
+    NodeSeparators index;
 
-    iterator find(PersistentMultiMap *set, const INDEX &val, int loc) { //find first no less than val
-      int p = upper_bound(index, index + size - 1, val) - index;
-      return set->getPtr(children[p], false).find(set, val, children[p]);
+    iterator find(PersistentMultiMap *set, const INDEX &val, const Key &key, int loc) { //find first no less than val
+      int p = index.upperBound(size - 1, key);
+      return set->getPtr(children[p], false).find(set, val, key, children[p]);
     }
 
-    bool insert(PersistentMultiMap *set, const T &val, TreeNode *parent, int pos) { //insert val into this node
-      int p = upper_bound(index, index + size - 1, val.index()) - index;
-      NodePtr child = set->getPtr(children[p], true);
-      if (child.insert(set, val, this, p)) {
-        if (size == SIZE_1) {
+    bool insert(PersistentMultiMap *set, const T &val, const Key &key, TreeNode *parent, int pos) { //insert val into this node
+      int p = index.upperBound(size - 1, key);
+      NodePtr child = set->getPtr(children[p], false);
+      if (child.insert(set, val, key, this, p)) {
+        if (size == SIZE_1 || index.crowded(size - 1)) {
           postInsert(set, parent, pos);
         }
         return true;
@@ -165,11 +190,13 @@ class PersistentMultiMap {
       return false;
     }
 
-    bool erase(PersistentMultiMap *set, const INDEX &val, TreeNode *parent, int pos) { //erase val from this node
-      int p = upper_bound(index, index + size - 1, val) - index;
-      NodePtr child = set->getPtr(children[p], true);
-      if (child.erase(set, val, this, p)) {
-        if (size == SIZE_1 / 2 - 1) {
+    bool erase(PersistentMultiMap *set, const INDEX &val, const Key &key, TreeNode *parent, int pos) { //erase val from this node
+      int p = index.upperBound(size - 1, key);
+      NodePtr child = set->getPtr(children[p], false);
+      if (child.erase(set, val, key, this, p)) {
+        if (index.crowded(size - 1)) { //a separator may have been replaced by a longer one
+          postInsert(set, parent, pos);
+        } else if (size < SIZE_1 / 4 && index.used(size - 1) < SEPARATOR_BYTES / 4) {
           postErase(set, parent, pos);
         }
         return true;
@@ -177,75 +204,97 @@ class PersistentMultiMap {
       return false;
     }
 
-    void insertChild(int newChild, const INDEX &newIndex,
+    void insertChild(int newChild, const Key &newIndex,
                      int pos) { //insert newChild after children[pos] and newIndex after index[pos-1]
-      int indexPos = pos;
       int childPos = pos + 1;
-      memmove(index + indexPos + 1, index + indexPos, (size - indexPos - 1) * sizeof(INDEX));
+      index.insert(size - 1, pos, newIndex);
       memmove(children + childPos + 1, children + childPos, (size - childPos) * sizeof(int));
-      index[indexPos] = newIndex;
       children[childPos] = newChild;
       size++;
     }
 
     void eraseChild(int pos) { //erase a child after children[pos] and index[pos-1]
-      int indexPos = pos;
       int childPos = pos + 1;
-      memmove(index + indexPos, index + indexPos + 1, (size - indexPos - 2) * sizeof(INDEX));
+      index.erase(size - 1, pos);
       memmove(children + childPos, children + childPos + 1, (size - childPos - 1) * sizeof(int));
       size--;
     }
 
-    void postInsert(PersistentMultiMap *set, TreeNode *parent, int pos) { //when size==SIZE
+    //when size==SIZE_1 or the separators are crowded. the halves hold about as many bytes. the prefix of this
+    //node stays valid for both, and the separators around them in parent may give a longer one
+    void postInsert(PersistentMultiMap *set, TreeNode *parent, int pos) {
+      Key keys[SIZE_1 - 1];
+      index.getAll(size - 1, keys);
       TreeNode newNode;
-      int half = size / 2;
-      newNode.size = half;
+      int half = NodeSeparators::middle(keys, size - 1, index.prefix);
+      newNode.size = size - half;
+      memcpy(newNode.children, children + half, newNode.size * sizeof(int));
       size = half;
-      memcpy(newNode.index, index + half, (half - 1) * sizeof(INDEX));
-      memcpy(newNode.children, children + half, half * sizeof(int));
-      parent->insertChild(set->add(newNode), index[half - 1], pos);
+      set->modify(parent);
+      parent->insertChild(-1, keys[half - 1], pos); //the new node is added once its prefix is known
+      int prefix = index.prefix;
+      index.assign(keys, half - 1, std::max(prefix, parent->index.prefixOf(parent->size - 1, pos, pos)));
+      newNode.index.assign(keys + half, newNode.size - 1,
+                           std::max(prefix, parent->index.prefixOf(parent->size - 1, pos + 1, pos + 1)));
+      parent->children[pos + 1] = set->add(newNode);
     }
 
-    void postErase(PersistentMultiMap *set, TreeNode *parent, int pos) { //when size==SIZE/2-1
+    void postErase(PersistentMultiMap *set, TreeNode *parent, int pos) { //when less than a quarter full
       if (parent->size == 1) { //root
         return;
       }
       if (pos == 0) {
-        TreeNode *sibling = set->getPtr(parent->children[pos + 1], true).treeNode();
-        if (sibling->size > SIZE_1 / 2) {
-          memcpy(index + size - 1, parent->index + pos, sizeof(INDEX));
-          memcpy(children + size, sibling->children, sizeof(int));
-          memcpy(parent->index + pos, sibling->index, sizeof(INDEX));
-          memmove(sibling->index, sibling->index + 1, (sibling->size - 2) * sizeof(INDEX));
-          memmove(sibling->children, sibling->children + 1, (sibling->size - 1) * sizeof(int));
-          size++;
-          sibling->size--;
-        } else {
-          this->merge(set, sibling, parent, pos);
-        }
+        TreeNode *sibling = set->getPtr(parent->children[pos + 1], false).treeNode();
+        set->modify(sibling);
+        set->modify(parent);
+        rebalance(set, sibling, parent, pos);
       } else {
-        TreeNode *sibling = set->getPtr(parent->children[pos - 1], true).treeNode();
-        if (sibling->size > SIZE_1 / 2) {
-          memmove(index + 1, index, (size - 1) * sizeof(INDEX));
-          memmove(children + 1, children, size * sizeof(int));
-          memcpy(index, parent->index + pos - 1, sizeof(INDEX));
-          memcpy(children, sibling->children + sibling->size - 1, sizeof(int));
-          memcpy(parent->index + pos - 1, sibling->index + sibling->size - 2, sizeof(INDEX));
-          size++;
-          sibling->size--;
-        } else {
-          sibling->merge(set, this, parent, pos - 1);
-        }
+        TreeNode *sibling = set->getPtr(parent->children[pos - 1], false).treeNode();
+        set->modify(sibling);
+        set->modify(parent);
+        sibling->rebalance(set, this, parent, pos - 1);
       }
     }
 
-    void merge(PersistentMultiMap *set, TreeNode *sibling, TreeNode *parent, int pos) { //sibling is parent->children[pos+1]
-      memcpy(index + size - 1, parent->index + pos, sizeof(INDEX));
-      memcpy(index + size, sibling->index, (sibling->size - 1) * sizeof(INDEX));
-      memcpy(children + size, sibling->children, sibling->size * sizeof(int));
-      size += sibling->size;
-      set->remove(parent->children[pos + 1]);
-      parent->eraseChild(pos);
+    //merge sibling, which is parent->children[pos+1], into this node, or if they do not fit in one, share their
+    //children so that both hold about as many bytes. the prefix both nodes share stays valid for their new ranges,
+    //and the separators around them in parent may give a longer one. nothing changes if a node would not fit
+    void rebalance(PersistentMultiMap *set, TreeNode *sibling, TreeNode *parent, int pos) {
+      Key keys[2 * SIZE_1 - 1];
+      index.getAll(size - 1, keys);
+      keys[size - 1] = parent->index.get(pos);
+      sibling->index.getAll(sibling->size - 1, keys + size);
+      int total = size + sibling->size;
+      int parentCount = parent->size - 1;
+      int shared = index.commonPrefix(sibling->index);
+      int prefix = std::max(shared, parent->index.prefixOf(parentCount, pos, pos + 1));
+      if (total < SIZE_1 && NodeSeparators::fits(keys, total - 1, prefix)) {
+        index.assign(keys, total - 1, prefix);
+        memcpy(children + size, sibling->children, sibling->size * sizeof(int));
+        size = total;
+        set->remove(parent->children[pos + 1]);
+        parent->eraseChild(pos);
+        return;
+      }
+      int kept = NodeSeparators::middle(keys, total - 1, shared);
+      const Key &middle = keys[kept - 1];
+      prefix = std::max(shared, pos == 0 ? parent->index.prefix : parent->index.get(pos - 1).commonPrefix(middle));
+      int siblingPrefix = std::max(shared, pos + 1 == parentCount ? parent->index.prefix
+                                                                  : middle.commonPrefix(parent->index.get(pos + 1)));
+      if (!NodeSeparators::fits(keys, kept - 1, prefix) ||
+          !NodeSeparators::fits(keys + kept, total - kept - 1, siblingPrefix)) {
+        return;
+      }
+      int all[2 * SIZE_1];
+      memcpy(all, children, size * sizeof(int));
+      memcpy(all + size, sibling->children, sibling->size * sizeof(int));
+      parent->index.replace(parentCount, pos, middle);
+      index.assign(keys, kept - 1, prefix);
+      sibling->index.assign(keys + kept, total - kept - 1, siblingPrefix);
+      memcpy(children, all, kept * sizeof(int));
+      memcpy(sibling->children, all + kept, (total - kept) * sizeof(int));
+      size = kept;
+      sibling->size = total - kept;
     }
   };
 
@@ -260,15 +309,17 @@ class PersistentMultiMap {
     }
 
     bool insert(PersistentMultiMap *set, const T &val, TreeNode *parent, int pos) { //insert val into this node
-      int p = lower_index_bound(data, data + size, val.index()) - data;
+      int p = size > 0 && data[size - 1].index() < val.index() ? size //appending, as pushBack mostly does
+                                                               : lower_index_bound(data, data + size, val.index()) - data;
       if (p < size && data[p].index() == val.index()) {
         return false;
       }
+      set->modify(this);
       memmove(data + p + 1, data + p, (size - p) * sizeof(T));
       data[p] = val;
       size++;
       if (size == SIZE_2) {
-        postInsert(set, parent, pos);
+        postInsert(set, parent, pos, p);
       }
       return true;
     }
@@ -278,46 +329,63 @@ class PersistentMultiMap {
       if (p >= size || data[p].index() != val) {
         return false;
       }
+      set->modify(this);
       memmove(data + p, data + p + 1, (size - p - 1) * sizeof(T));
       size--;
-      if (size == SIZE_2 / 2 - 1) {
+      if (size < SIZE_2 / 2) { //leaves left small by biased splits are filled up on their first erase
         postErase(set, parent, pos);
       }
       return true;
     }
 
-    void postInsert(PersistentMultiMap *set, TreeNode *parent, int pos) { //when size==SIZE
+    //when size==SIZE. p is where the last element went. a key whose run ends the leaf is being appended to,
+    //so most of the leaf stays where it is and the run gets a nearly empty leaf. likewise at the front
+    void postInsert(PersistentMultiMap *set, TreeNode *parent, int pos, int p) {
+      int split = size / 2;
+      if (p == size - 1 && data[p - 1].val.index() == data[p].val.index()) {
+        split = size - std::max(1, size / 10);
+      } else if (p == 0 && data[1].val.index() == data[0].val.index()) {
+        split = std::max(1, size / 10);
+      }
       LeafNode newNode;
-      int half = size / 2;
-      newNode.size = half;
-      size = half;
-      memcpy(newNode.data, data + half, half * sizeof(T));
+      newNode.size = size - split;
+      size = split;
+      memcpy(newNode.data, data + split, newNode.size * sizeof(T));
       newNode.next = next;
       next = set->add(newNode);
-      parent->insertChild(next, data[half].index(), pos);
+      set->modify(parent);
+      parent->insertChild(next, Key::separator(Key(data[size - 1].index()), Key(newNode.data[0].index())), pos);
+      set->shape++;
     }
 
-    void postErase(PersistentMultiMap *set, TreeNode *parent, int pos) { //when size==SIZE/2-1
+    void postErase(PersistentMultiMap *set, TreeNode *parent, int pos) { //when size<SIZE/2
       if (parent->size == 1) { //root
         return;
       }
+      set->shape++;
       if (pos == 0) {
-        LeafNode *sibling = set->getPtr(parent->children[pos + 1], true).leafNode();
+        LeafNode *sibling = set->getPtr(parent->children[pos + 1], false).leafNode();
+        set->modify(sibling);
+        set->modify(parent);
         if (sibling->size > SIZE_2 / 2) {
           memcpy(data + size, sibling->data, sizeof(T)); //copy one here
           memmove(sibling->data, sibling->data + 1, (sibling->size - 1) * sizeof(T)); //delete one from sibling
-          memcpy(parent->index + pos, sibling->data, sizeof(INDEX)); //replace parent's index
+          parent->index.replace(parent->size - 1, pos,
+                                Key::separator(Key(data[size].index()), Key(sibling->data[0].index())));
           size++;
           sibling->size--;
         } else {
           this->merge(set, sibling, parent, pos);
         }
       } else {
-        LeafNode *sibling = set->getPtr(parent->children[pos - 1], true).leafNode();
+        LeafNode *sibling = set->getPtr(parent->children[pos - 1], false).leafNode();
+        set->modify(sibling);
+        set->modify(parent);
         if (sibling->size > SIZE_2 / 2) {
           memmove(data + 1, data, size * sizeof(T)); //leave one space for copy
           memcpy(data, sibling->data + sibling->size - 1, sizeof(T)); //copy one here
-          memcpy(parent->index + pos - 1, data, sizeof(INDEX)); //replace parent's index
+          parent->index.replace(parent->size - 1, pos - 1,
+                                Key::separator(Key(sibling->data[sibling->size - 2].index()), Key(data[0].index())));
           size++;
           sibling->size--;
         } else {
@@ -333,11 +401,41 @@ class PersistentMultiMap {
       set->remove(parent->children[pos + 1]);
       parent->eraseChild(pos);
     }
+
+    //the link to the next leaf by its index in the storage, for rewrites of it (see FileStorage::copy)
+    static int linkOf(const LeafNode &leaf) {
+      return leaf.next == -1 ? -1 : leaf.next >> 1;
+    }
+
+    static void relink(LeafNode &leaf, int index) {
+      leaf.next = index == -1 ? -1 : index << 1;
+    }
+  };
+
+  static constexpr int HINT_COUNT = 64;
+
+  struct Hint { //a leaf and the range of indexes it covers, as found by the last descent for keys of one hash
+    int leaf = -1;
+    Key low, high; //low <= index < high, where the bound is present
+    bool hasLow = false, hasHigh = false;
+    unsigned long long shape = 0;
+
+    bool covers(const Key &val) const {
+      return (!hasLow || low.compare(val) <= 0) && (!hasHigh || val.compare(high) < 0);
+    }
   };
 
   TreeNode dummy; //there is a fake tree node which always points to the root
-  SuperFileStorage<TreeNode, int, MAX_TREE_SIZE> treeNodeStorage; //int is the index of the root
-  FileStorage<LeafNode, int, 0> leafNodeStorage; //int is total
+  OptimisticLock rootLock; //latch of dummy
+  int published; //index of the root as seen by snapshot readers
+  Versions<int> publishedVersions;
+  std::mutex writeLatch; //writers are serialized. readers are not
+  list<OptimisticLock *> latched; //held by the writer. iterators may latch any number of nodes
+  SuperFileStorage<TreeNode, int> treeNodeStorage; //int is the index of the root
+  FileStorage<LeafNode, int, LEAF_CACHE_SIZE> leafNodeStorage; //int is total
+  Key compactKey; //the last key copied by the running compaction
+  Hint hints[HINT_COUNT];
+  unsigned long long shape = 1; //bumped whenever the ranges of the leaves change, which outdates all hints
 
   NodePtr getPtr(int index, bool dirty) {
     if (index == -1) {
@@ -349,8 +447,165 @@ class PersistentMultiMap {
     return NodePtr(leafNodeStorage.get(index >> 1, dirty));
   }
 
+  //a snapshot reader sees the root as of its epoch
+  int rootIndex() {
+    if (Snapshot::reading()) {
+      bool first;
+      return *publishedVersions.read(published, first);
+    }
+    return dummy.children[0];
+  }
+
   NodePtr getRoot() {
-    return getPtr(dummy.children[0], true);
+    return getPtr(rootIndex(), false);
+  }
+
+  void publish() { //called at the end of every write
+    if (published != dummy.children[0]) {
+      publishedVersions.write(published);
+      published = dummy.children[0];
+    }
+  }
+
+  OptimisticLock &lockOf(NodePtr node) {
+    return node.isLeaf ? leafNodeStorage.lockOf(node.leafNode()) : treeNodeStorage.lockOf(node.treeNode());
+  }
+
+  //writers latch every node right before changing it, and release all latches when the operation ends
+  void latch(OptimisticLock &lock) {
+    for (size_t i = 0; i < latched.size(); i++) {
+      if (latched[i] == &lock) {
+        return;
+      }
+    }
+    lock.writeLock();
+    latched.push_back(&lock);
+  }
+
+  void modify(TreeNode *node) {
+    latch(node == &dummy ? rootLock : treeNodeStorage.modify(node));
+  }
+
+  void modify(LeafNode *node) {
+    latch(leafNodeStorage.modify(node));
+  }
+
+  void unlatch() {
+    while (!latched.empty()) {
+      latched.back()->writeUnlock();
+      latched.pop_back();
+    }
+  }
+
+  //find the leaf which may hold val with optimistic lock coupling: the version of a node is checked again
+  //after the version of its child is taken. return false if a writer got in the way
+  bool descend(const INDEX &val, LeafNode *&leaf, unsigned long long &leafVersion) {
+    OptimisticLock *lock = &rootLock;
+    unsigned long long version;
+    if (!lock->readLock(version)) {
+      return false;
+    }
+    Key key(val);
+    int index = dummy.children[0];
+    while (true) {
+      if (!lock->validate(version)) {
+        return false;
+      }
+      NodePtr child = getPtr(index, false);
+      OptimisticLock *childLock = &lockOf(child);
+      unsigned long long childVersion;
+      if (!childLock->readLock(childVersion) || !lock->validate(version)) {
+        return false;
+      }
+      if (child.isLeaf) {
+        leaf = child.leafNode();
+        leafVersion = childVersion;
+        return true;
+      }
+      TreeNode *node = child.treeNode();
+      int size = node->size < 1 ? 1 : node->size > SIZE_1 ? SIZE_1 : node->size; //may be torn
+      index = node->children[node->index.upperBound(size - 1, key)];
+      lock = childLock;
+      version = childVersion;
+    }
+  }
+
+  //hint the storage to read the count leaves after leaf, but for the first skip, which were hinted before. the leaves
+  //are found from the tree nodes, which are in memory, rather than from the chain, which would need each one read in
+  //turn. iterators run in the writer or on a snapshot, so the nodes do not change meanwhile
+  void prefetch(LeafNode *leaf, int skip, int count) {
+    if (leaf->size == 0) {
+      return;
+    }
+    Key key(leaf->data[0].index());
+    TreeNode *path[MAX_HEIGHT];
+    int pos[MAX_HEIGHT];
+    int height = 0;
+    int index = rootIndex();
+    while (index & 1) {
+      if (height == MAX_HEIGHT) {
+        return;
+      }
+      path[height] = treeNodeStorage.get(index >> 1, false);
+      pos[height] = path[height]->index.upperBound(path[height]->size - 1, key);
+      index = path[height]->children[pos[height]];
+      height++;
+    }
+    for (int i = 0; i < count; i++) { //step to the next leaf like an odometer
+      int h = height - 1;
+      while (h >= 0 && pos[h] + 1 >= path[h]->size) {
+        h--;
+      }
+      if (h < 0) {
+        return;
+      }
+      index = path[h]->children[++pos[h]];
+      while (++h < height) {
+        path[h] = treeNodeStorage.get(index >> 1, false);
+        pos[h] = 0;
+        index = path[h]->children[0];
+      }
+      if (i >= skip) {
+        leafNodeStorage.prefetch(index >> 1);
+      }
+    }
+  }
+
+  //the leaf whose range holds key, found from the tree nodes alone. in the writer thread
+  int leafOf(const Key &key) {
+    int index = dummy.children[0];
+    while (index & 1) {
+      TreeNode *node = treeNodeStorage.get(index >> 1, false);
+      index = node->children[node->index.upperBound(node->size - 1, key)];
+    }
+    return index;
+  }
+
+  //call f with a reference to every link to a leaf, from the tree nodes, which are in memory, or from dummy.
+  //the nodes holding them are marked as changed if modify is set
+  template<typename F>
+  void forEachLeafLink(bool modify, F f) {
+    if (!(dummy.children[0] & 1)) {
+      f(dummy.children[0]);
+      return;
+    }
+    list<int> nodes;
+    nodes.push_back(dummy.children[0] >> 1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      TreeNode *node = treeNodeStorage.get(nodes[i], false);
+      if (node->children[0] & 1) {
+        for (int j = 0; j < node->size; j++) {
+          nodes.push_back(node->children[j] >> 1);
+        }
+        continue;
+      }
+      if (modify) {
+        treeNodeStorage.modify(node);
+      }
+      for (int j = 0; j < node->size; j++) {
+        f(node->children[j]);
+      }
+    }
   }
 
   int add(const TreeNode &node) {
@@ -369,6 +624,49 @@ class PersistentMultiMap {
     }
   }
 
+  Hint locate(const Key &val) { //for the writer
+    Hint hint;
+    hint.shape = shape;
+    int index = dummy.children[0];
+    while (index & 1) {
+      TreeNode *node = getPtr(index, false).treeNode();
+      int p = node->index.upperBound(node->size - 1, val);
+      if (p > 0) {
+        hint.low = node->index.get(p - 1);
+        hint.hasLow = true;
+      }
+      if (p < node->size - 1) {
+        hint.high = node->index.get(p);
+        hint.hasHigh = true;
+      }
+      index = node->children[p];
+    }
+    hint.leaf = index;
+    return hint;
+  }
+
+  //insert at the front or the end of the range of a key. the leaf found last time for the key is tried first,
+  //and the tree is only descended again if the leaf no longer covers val or is about to split
+  void append(const T &val) {
+    Key key(val.index());
+    Hint &hint = hints[hashOf(val.val.index()) % HINT_COUNT];
+    if (hint.shape != shape || !hint.covers(key)) {
+      hint = locate(key);
+    }
+    LeafNode *leaf = getPtr(hint.leaf, false).leafNode();
+    if (leaf->size + 1 < SIZE_2) {
+      leaf->insert(this, val, nullptr, 0);
+      return;
+    }
+    getRoot().insert(this, val, key, &dummy, 0);
+    if (dummy.size == 2) {
+      TreeNode newRoot;
+      newRoot.size = 1;
+      newRoot.children[0] = add(dummy);
+      dummy = newRoot;
+    }
+  }
+
 public:
   int total;
   explicit PersistentMultiMap(std::string file_name) : treeNodeStorage(-1, file_name + "_tree"),
@@ -376,9 +674,92 @@ public:
     dummy.size = 1;
     dummy.children[0] = treeNodeStorage.info == -1 ? add(LeafNode()) : treeNodeStorage.info;
     total = leafNodeStorage.info;
+    published = dummy.children[0];
+  }
+
+  //write the whole tree back to its files. see NamedSnapshots
+  void checkpoint() {
+    unlatch();
+    treeNodeStorage.info = dummy.children[0];
+    leafNodeStorage.info = total;
+    treeNodeStorage.checkpoint();
+    leafNodeStorage.checkpoint();
+  }
+
+  //check the files against their checksums after checkpoint. return the number of bad records
+  int scrub() {
+    return treeNodeStorage.scrub() + leafNodeStorage.scrub();
+  }
+
+  //read the tree again after its files have changed underneath. no reader may be running
+  void reload() {
+    unlatch();
+    treeNodeStorage.reload();
+    leafNodeStorage.reload();
+    dummy.children[0] = treeNodeStorage.info;
+    total = leafNodeStorage.info;
+    published = dummy.children[0];
+    publishedVersions.collect(Snapshot::horizon());
+    shape++;
+  }
+
+  //online compaction: the leaves are copied in key order into a fresh file a few at a time between writes, and the
+  //copy then takes the place of the file, which scans then read front to back. see FileStorage::beginRewrite
+  void beginCompaction() {
+    leafNodeStorage.beginRewrite();
+    compactKey = Key();
   }
 
-  void checkCache() {
+  void cancelCompaction() {
+    leafNodeStorage.cancelRewrite();
+  }
+
+  //copy leaves from where the last step stopped until budget bytes are spent, and return whether all are copied.
+  //the walk is picked up by key, since the leaf it stopped at may have been merged away meanwhile
+  bool compactStep(long long &budget) {
+    unlatch();
+    int index = leafOf(compactKey) >> 1;
+    while (budget > 0 && index != -1) {
+      LeafNode *leaf = leafNodeStorage.get(index, false);
+      budget -= sizeof(LeafNode);
+      if (leafNodeStorage.copied(index)) {
+        index = LeafNode::linkOf(*leaf);
+        continue;
+      }
+      if (leaf->size > 0) {
+        compactKey = Key(leaf->data[leaf->size - 1].index());
+      }
+      index = leafNodeStorage.copy(index);
+      budget -= sizeof(LeafNode);
+    }
+    return index == -1;
+  }
+
+  //put the copy in place, after copying the leaves which the walk missed, if any. no reader may be running
+  void finishCompaction() {
+    unlatch();
+    forEachLeafLink(false, [this](int &link) {
+      if (!leafNodeStorage.copied(link >> 1)) {
+        leafNodeStorage.copy(link >> 1);
+      }
+    });
+    leafNodeStorage.info = total;
+    map<int, int> slots;
+    if (!leafNodeStorage.finishRewrite(slots)) {
+      return;
+    }
+    forEachLeafLink(true, [&slots](int &link) {
+      link = slots.at(link >> 1) << 1;
+    });
+    published = dummy.children[0];
+    publishedVersions.collect(Snapshot::horizon());
+    shape++;
+  }
+
+  void checkCache() { //must not run alongside readers other than snapshot readers
+    unlatch();
+    publishedVersions.collect(Snapshot::horizon());
+    treeNodeStorage.checkCache();
     leafNodeStorage.checkCache();
   }
 
@@ -388,58 +769,121 @@ public:
   }
 
   int pushBack(const T0 &val) {
+    std::lock_guard guard(writeLatch);
     int ret = total;
     total++;
     if(total <= 0) {
       throw;
     }
-    getRoot().insert(this, {val, ret}, &dummy, 0);
-    if (dummy.size == 2) {
-      TreeNode newRoot;
-      newRoot.size = 1;
-      newRoot.children[0] = add(dummy);
-      dummy = newRoot;
-    }
+    append({val, ret});
+    publish();
+    unlatch();
     return ret;
   }
 
   int pushFront(const T0 &val) {
+    std::lock_guard guard(writeLatch);
     int ret = -total;
     total++;
     if(total <= 0) {
       throw;
     }
-    getRoot().insert(this, {val, ret}, &dummy, 0);
-    if (dummy.size == 2) {
+    append({val, ret});
+    publish();
+    unlatch();
+    return ret;
+  }
+
+  bool erase(const T0::INDEX &val, int tick) {
+    std::lock_guard guard(writeLatch);
+    INDEX index{val, tick};
+    bool ret = getRoot().erase(this, index, Key(index), &dummy, 0);
+    if (dummy.size == 2) { //the root split on a longer separator
       TreeNode newRoot;
       newRoot.size = 1;
       newRoot.children[0] = add(dummy);
       dummy = newRoot;
     }
-    return ret;
-  }
-
-  bool erase(const T0::INDEX &val, int tick) {
-    bool ret = getRoot().erase(this, {val, tick}, &dummy, 0);
     NodePtr root = getRoot();
     if (!root.isLeaf) {
       TreeNode rootNode = *root.treeNode();
       if (rootNode.size == 1) {
+        modify(&dummy);
+        modify(root.treeNode());
         remove(dummy.children[0]);
         dummy = rootNode;
       }
     }
+    publish();
+    unlatch();
     return ret;
   }
 
   iterator find(const T0::INDEX &val) { //find the first element no less than val
-    return getRoot().find(this, {val, INT32_MIN}, dummy.children[0]);
+    int root = rootIndex();
+    INDEX index{val, INT32_MIN};
+    return getPtr(root, false).find(this, index, Key(index), root);
   }
 
   Optional<iterator> get(const T0::INDEX &val, int tick) {
-    iterator it = getRoot().find(this, {val, tick}, dummy.children[0]);
+    int root = rootIndex();
+    INDEX index{val, tick};
+    iterator it = getPtr(root, false).find(this, index, Key(index), root);
     return (!it.end() && it->val.index() == val && it->tick == tick) ? Optional<iterator>(it) : Optional<iterator>();
   }
+
+  //visit elements no less than from in order until f returns false. may run in many threads alongside one writer:
+  //a leaf is copied and validated before its records are visited, and is looked up again if it changed meanwhile
+  template<typename F>
+  void scan(const T0::INDEX &val, F f) {
+    if (Snapshot::reading()) { //images never change
+      for (iterator it = find(val); !it.end(); ++it) {
+        if (!f(it->val, it->tick)) {
+          return;
+        }
+      }
+      return;
+    }
+    INDEX from{val, INT32_MIN};
+    bool inclusive = true;
+    LeafNode copy;
+    while (true) {
+      LeafNode *leaf;
+      unsigned long long version;
+      if (!descend(from, leaf, version)) {
+        continue;
+      }
+      while (true) {
+        copy = *leaf;
+        if (!leafNodeStorage.lockOf(leaf).validate(version)) {
+          break;
+        }
+        T *first = inclusive ? lower_index_bound(copy.data, copy.data + copy.size, from)
+                             : upper_index_bound(copy.data, copy.data + copy.size, from);
+        for (T *it = first; it < copy.data + copy.size; it++) {
+          if (!f(it->val, it->tick)) {
+            return;
+          }
+        }
+        if (copy.size > 0) {
+          from = copy.data[copy.size - 1].index();
+          inclusive = false;
+        }
+        if (copy.next == -1) {
+          return;
+        }
+        //a leaf is only removed by merging it into its left neighbour, so next is valid while leaf is unchanged
+        LeafNode *next = getPtr(copy.next, false).leafNode();
+        unsigned long long nextVersion;
+        if (!leafNodeStorage.lockOf(next).readLock(nextVersion) || !leafNodeStorage.lockOf(leaf).validate(version)) {
+          break;
+        }
+        leafNodeStorage.prefetch(next->next >> 1); //may be torn, but it is only a hint
+        leaf = next;
+        version = nextVersion;
+      }
+    }
+  }
 };
 
 #endif
\ No newline at end of file
@@ -8,20 +8,34 @@
 #include "../util/Util.hpp"
 #include "../file_storage/FileStorage.hpp"
 #include "../file_storage/SuperFileStorage.hpp"
+#include "../util/OptimisticLock.hpp"
+#include "../util/Snapshot.hpp"
+#include "Separators.hpp"
+#include <mutex>
 
-template<typename T, int MAX_TREE_SIZE = 1000>
+template<typename T, int LEAF_CACHE_SIZE = 0>
 class PersistentSet { //use T as key
   struct TreeNode;
   struct LeafNode;
 
   static constexpr int SIZE = 1000 / sizeof(T) * 2;
+  static constexpr int SIZE_1 = 256; //children of a tree node at most. most nodes run out of separator bytes first
+  static constexpr int SEPARATOR_BYTES = 2048;
 
   static_assert(SIZE >= 4 && SIZE % 2 == 0, "SIZE must be even and at least 4");
 
+  typedef Separators<T, SIZE_1 - 1, SEPARATOR_BYTES> NodeSeparators;
+  typedef NodeSeparators::Key Key;
+
+  static constexpr int PREFETCH_LEAVES = 8; //leaves kept on their way ahead of a long scan at most
+  static constexpr int MAX_HEIGHT = 16;
+
   class iterator {
     PersistentSet *set;
     LeafNode *leaf;
     int pos;
+    int ahead = 0; //leaves after this one which were hinted
+    int window = 1; //leaves to keep hinted. it grows as the scan goes on, since most scans end within a leaf or two
   public:
     iterator(PersistentSet *set, LeafNode *leaf, int pos) : set(set), leaf(leaf), pos(pos) {}
 
@@ -33,6 +47,11 @@ class PersistentSet { //use T as key
       if (pos == leaf->size) {
         leaf = leaf->next == -1 ? nullptr : set->getPtr(leaf->next, false).leafNode();
         pos = 0;
+        if (leaf && --ahead <= window / 2) { //the scan goes on, so read the next leaves while this one is used
+          window = window * 2 < PREFETCH_LEAVES ? window * 2 : PREFETCH_LEAVES;
+          set->prefetch(leaf, ahead < 0 ? 0 : ahead, window);
+          ahead = window;
+        }
       }
       return *this;
     }
@@ -89,46 +108,46 @@ class PersistentSet { //use T as key
       return static_cast<LeafNode *>(ptr);
     }
 
-    bool insert(PersistentSet *set, const T &val, TreeNode *parent, int parentPos) {
+    bool insert(PersistentSet *set, const T &val, const Key &key, TreeNode *parent, int parentPos) {
       if (isLeaf) {
         return leafNode()->insert(set, val, parent, parentPos);
       } else {
-        return treeNode()->insert(set, val, parent, parentPos);
+        return treeNode()->insert(set, val, key, parent, parentPos);
       }
     }
 
-    bool erase(PersistentSet *set, const T &val, TreeNode *parent, int parentPos) {
+    bool erase(PersistentSet *set, const T &val, const Key &key, TreeNode *parent, int parentPos) {
       if (isLeaf) {
         return leafNode()->erase(set, val, parent, parentPos);
       } else {
-        return treeNode()->erase(set, val, parent, parentPos);
+        return treeNode()->erase(set, val, key, parent, parentPos);
       }
     }
 
-    iterator find(PersistentSet *set, const T &val) {
+    iterator find(PersistentSet *set, const T &val, const Key &key) {
       if (isLeaf) {
         return leafNode()->find(set, val);
       } else {
-        return treeNode()->find(set, val);
+        return treeNode()->find(set, val, key);
       }
     }
   };
 
   struct TreeNode {
     int size = 0; //the number of children
-    T index[SIZE - 1];
-    int children[SIZE];
+    int children[SIZE_1];
+    NodeSeparators index;
 
-    iterator find(PersistentSet *set, const T &val) { //find first no less than val
-      int p = upper_bound(index, index + size - 1, val) - index;
-      return set->getPtr(children[p], false).find(set, val);
+    iterator find(PersistentSet *set, const T &val, const Key &key) { //find first no less than val
+      int p = index.upperBound(size - 1, key);
+      return set->getPtr(children[p], false).find(set, val, key);
     }
 
-    bool insert(PersistentSet *set, const T &val, TreeNode *parent, int pos) { //insert val into this node
-      int p = upper_bound(index, index + size - 1, val) - index;
-      NodePtr child = set->getPtr(children[p], true);
-      if (child.insert(set, val, this, p)) {
-        if (size == SIZE) {
+    bool insert(PersistentSet *set, const T &val, const Key &key, TreeNode *parent, int pos) { //insert val into this node
+      int p = index.upperBound(size - 1, key);
+      NodePtr child = set->getPtr(children[p], false);
+      if (child.insert(set, val, key, this, p)) {
+        if (size == SIZE_1 || index.crowded(size - 1)) {
           postInsert(set, parent, pos);
         }
         return true;
@@ -136,11 +155,13 @@ class PersistentSet { //use T as key
       return false;
     }
 
-    bool erase(PersistentSet *set, const T &val, TreeNode *parent, int pos) { //erase val from this node
-      int p = upper_bound(index, index + size - 1, val) - index;
-      NodePtr child = set->getPtr(children[p], true);
-      if (child.erase(set, val, this, p)) {
-        if (size == SIZE / 2 - 1) {
+    bool erase(PersistentSet *set, const T &val, const Key &key, TreeNode *parent, int pos) { //erase val from this node
+      int p = index.upperBound(size - 1, key);
+      NodePtr child = set->getPtr(children[p], false);
+      if (child.erase(set, val, key, this, p)) {
+        if (index.crowded(size - 1)) { //a separator may have been replaced by a longer one
+          postInsert(set, parent, pos);
+        } else if (size < SIZE_1 / 4 && index.used(size - 1) < SEPARATOR_BYTES / 4) {
           postErase(set, parent, pos);
         }
         return true;
@@ -148,75 +169,97 @@ class PersistentSet { //use T as key
       return false;
     }
 
-    void insertChild(int newChild, const T &newIndex,
+    void insertChild(int newChild, const Key &newIndex,
                      int pos) { //insert newChild after children[pos] and newIndex after index[pos-1]
-      int indexPos = pos;
       int childPos = pos + 1;
-      memmove(index + indexPos + 1, index + indexPos, (size - indexPos - 1) * sizeof(T));
+      index.insert(size - 1, pos, newIndex);
       memmove(children + childPos + 1, children + childPos, (size - childPos) * sizeof(int));
-      index[indexPos] = newIndex;
       children[childPos] = newChild;
       size++;
     }
 
     void eraseChild(int pos) { //erase a child after children[pos] and index[pos-1]
-      int indexPos = pos;
       int childPos = pos + 1;
-      memmove(index + indexPos, index + indexPos + 1, (size - indexPos - 2) * sizeof(T));
+      index.erase(size - 1, pos);
       memmove(children + childPos, children + childPos + 1, (size - childPos - 1) * sizeof(int));
       size--;
     }
 
-    void postInsert(PersistentSet *set, TreeNode *parent, int pos) { //when size==SIZE
+    //when size==SIZE_1 or the separators are crowded. the halves hold about as many bytes. the prefix of this
+    //node stays valid for both, and the separators around them in parent may give a longer one
+    void postInsert(PersistentSet *set, TreeNode *parent, int pos) {
+      Key keys[SIZE_1 - 1];
+      index.getAll(size - 1, keys);
       TreeNode newNode;
-      int half = size / 2;
-      newNode.size = half;
+      int half = NodeSeparators::middle(keys, size - 1, index.prefix);
+      newNode.size = size - half;
+      memcpy(newNode.children, children + half, newNode.size * sizeof(int));
       size = half;
-      memcpy(newNode.index, index + half, (half - 1) * sizeof(T));
-      memcpy(newNode.children, children + half, half * sizeof(int));
-      parent->insertChild(set->add(newNode), index[half - 1], pos);
+      set->modify(parent);
+      parent->insertChild(-1, keys[half - 1], pos); //the new node is added once its prefix is known
+      int prefix = index.prefix;
+      index.assign(keys, half - 1, std::max(prefix, parent->index.prefixOf(parent->size - 1, pos, pos)));
+      newNode.index.assign(keys + half, newNode.size - 1,
+                           std::max(prefix, parent->index.prefixOf(parent->size - 1, pos + 1, pos + 1)));
+      parent->children[pos + 1] = set->add(newNode);
     }
 
-    void postErase(PersistentSet *set, TreeNode *parent, int pos) { //when size==SIZE/2-1
+    void postErase(PersistentSet *set, TreeNode *parent, int pos) { //when less than a quarter full
       if (parent->size == 1) { //root
         return;
       }
       if (pos == 0) {
-        TreeNode *sibling = set->getPtr(parent->children[pos + 1], true).treeNode();
-        if (sibling->size > SIZE / 2) {
-          memcpy(index + size - 1, parent->index + pos, sizeof(T));
-          memcpy(children + size, sibling->children, sizeof(int));
-          memcpy(parent->index + pos, sibling->index, sizeof(T));
-          memmove(sibling->index, sibling->index + 1, (sibling->size - 2) * sizeof(T));
-          memmove(sibling->children, sibling->children + 1, (sibling->size - 1) * sizeof(int));
-          size++;
-          sibling->size--;
-        } else {
-          this->merge(set, sibling, parent, pos);
-        }
+        TreeNode *sibling = set->getPtr(parent->children[pos + 1], false).treeNode();
+        set->modify(sibling);
+        set->modify(parent);
+        rebalance(set, sibling, parent, pos);
       } else {
-        TreeNode *sibling = set->getPtr(parent->children[pos - 1], true).treeNode();
-        if (sibling->size > SIZE / 2) {
-          memmove(index + 1, index, (size - 1) * sizeof(T));
-          memmove(children + 1, children, size * sizeof(int));
-          memcpy(index, parent->index + pos - 1, sizeof(T));
-          memcpy(children, sibling->children + sibling->size - 1, sizeof(int));
-          memcpy(parent->index + pos - 1, sibling->index + sibling->size - 2, sizeof(T));
-          size++;
-          sibling->size--;
-        } else {
-          sibling->merge(set, this, parent, pos - 1);
-        }
+        TreeNode *sibling = set->getPtr(parent->children[pos - 1], false).treeNode();
+        set->modify(sibling);
+        set->modify(parent);
+        sibling->rebalance(set, this, parent, pos - 1);
       }
     }
 
-    void merge(PersistentSet *set, TreeNode *sibling, TreeNode *parent, int pos) { //sibling is parent->children[pos+1]
-      memcpy(index + size - 1, parent->index + pos, sizeof(T));
-      memcpy(index + size, sibling->index, (sibling->size - 1) * sizeof(T));
-      memcpy(children + size, sibling->children, sibling->size * sizeof(int));
-      size += sibling->size;
-      set->remove(parent->children[pos + 1]);
-      parent->eraseChild(pos);
+    //merge sibling, which is parent->children[pos+1], into this node, or if they do not fit in one, share their
+    //children so that both hold about as many bytes. the prefix both nodes share stays valid for their new ranges,
+    //and the separators around them in parent may give a longer one. nothing changes if a node would not fit
+    void rebalance(PersistentSet *set, TreeNode *sibling, TreeNode *parent, int pos) {
+      Key keys[2 * SIZE_1 - 1];
+      index.getAll(size - 1, keys);
+      keys[size - 1] = parent->index.get(pos);
+      sibling->index.getAll(sibling->size - 1, keys + size);
+      int total = size + sibling->size;
+      int parentCount = parent->size - 1;
+      int shared = index.commonPrefix(sibling->index);
+      int prefix = std::max(shared, parent->index.prefixOf(parentCount, pos, pos + 1));
+      if (total < SIZE_1 && NodeSeparators::fits(keys, total - 1, prefix)) {
+        index.assign(keys, total - 1, prefix);
+        memcpy(children + size, sibling->children, sibling->size * sizeof(int));
+        size = total;
+        set->remove(parent->children[pos + 1]);
+        parent->eraseChild(pos);
+        return;
+      }
+      int kept = NodeSeparators::middle(keys, total - 1, shared);
+      const Key &middle = keys[kept - 1];
+      prefix = std::max(shared, pos == 0 ? parent->index.prefix : parent->index.get(pos - 1).commonPrefix(middle));
+      int siblingPrefix = std::max(shared, pos + 1 == parentCount ? parent->index.prefix
+                                                                  : middle.commonPrefix(parent->index.get(pos + 1)));
+      if (!NodeSeparators::fits(keys, kept - 1, prefix) ||
+          !NodeSeparators::fits(keys + kept, total - kept - 1, siblingPrefix)) {
+        return;
+      }
+      int all[2 * SIZE_1];
+      memcpy(all, children, size * sizeof(int));
+      memcpy(all + size, sibling->children, sibling->size * sizeof(int));
+      parent->index.replace(parentCount, pos, middle);
+      index.assign(keys, kept - 1, prefix);
+      sibling->index.assign(keys + kept, total - kept - 1, siblingPrefix);
+      memcpy(children, all, kept * sizeof(int));
+      memcpy(sibling->children, all + kept, (total - kept) * sizeof(int));
+      size = kept;
+      sibling->size = total - kept;
     }
   };
 
@@ -235,6 +278,7 @@ class PersistentSet { //use T as key
       if (p < size && data[p] == val) {
         return false;
       }
+      set->modify(this);
       memmove(data + p + 1, data + p, (size - p) * sizeof(T));
       data[p] = val;
       size++;
@@ -249,6 +293,7 @@ class PersistentSet { //use T as key
       if (p >= size || data[p] != val) {
         return false;
       }
+      set->modify(this);
       memmove(data + p, data + p + 1, (size - p - 1) * sizeof(T));
       size--;
       if (size == SIZE / 2 - 1) {
@@ -265,7 +310,8 @@ class PersistentSet { //use T as key
       memcpy(newNode.data, data + half, half * sizeof(T));
       newNode.next = next;
       next = set->add(newNode);
-      parent->insertChild(next, data[half], pos);
+      set->modify(parent);
+      parent->insertChild(next, Key::separator(Key(data[half - 1]), Key(data[half])), pos);
     }
 
     void postErase(PersistentSet *set, TreeNode *parent, int pos) { //when size==SIZE/2-1
@@ -273,22 +319,27 @@ class PersistentSet { //use T as key
         return;
       }
       if (pos == 0) {
-        LeafNode *sibling = set->getPtr(parent->children[pos + 1], true).leafNode();
+        LeafNode *sibling = set->getPtr(parent->children[pos + 1], false).leafNode();
+        set->modify(sibling);
+        set->modify(parent);
         if (sibling->size > SIZE / 2) {
           memcpy(data + size, sibling->data, sizeof(T)); //copy one here
           memmove(sibling->data, sibling->data + 1, (sibling->size - 1) * sizeof(T)); //delete one from sibling
-          memcpy(parent->index + pos, sibling->data, sizeof(T)); //replace parent's index
+          parent->index.replace(parent->size - 1, pos, Key::separator(Key(data[size]), Key(sibling->data[0])));
           size++;
           sibling->size--;
         } else {
           this->merge(set, sibling, parent, pos);
         }
       } else {
-        LeafNode *sibling = set->getPtr(parent->children[pos - 1], true).leafNode();
+        LeafNode *sibling = set->getPtr(parent->children[pos - 1], false).leafNode();
+        set->modify(sibling);
+        set->modify(parent);
         if (sibling->size > SIZE / 2) {
           memmove(data + 1, data, size * sizeof(T)); //leave one space for copy
           memcpy(data, sibling->data + sibling->size - 1, sizeof(T)); //copy one here
-          memcpy(parent->index + pos - 1, data, sizeof(T)); //replace parent's index
+          parent->index.replace(parent->size - 1, pos - 1,
+                                Key::separator(Key(sibling->data[sibling->size - 2]), Key(data[0])));
           size++;
           sibling->size--;
         } else {
@@ -304,11 +355,26 @@ class PersistentSet { //use T as key
       set->remove(parent->children[pos + 1]);
       parent->eraseChild(pos);
     }
+
+    //the link to the next leaf by its index in the storage, for rewrites of it (see FileStorage::copy)
+    static int linkOf(const LeafNode &leaf) {
+      return leaf.next == -1 ? -1 : leaf.next >> 1;
+    }
+
+    static void relink(LeafNode &leaf, int index) {
+      leaf.next = index == -1 ? -1 : index << 1;
+    }
   };
 
   TreeNode dummy; //there is a fake tree node which always points to the root
-  SuperFileStorage<TreeNode, int, MAX_TREE_SIZE> treeNodeStorage; //int is the index of the root
-  FileStorage<LeafNode, int, 0> leafNodeStorage;
+  OptimisticLock rootLock; //latch of dummy
+  int published; //index of the root as seen by snapshot readers
+  Versions<int> publishedVersions;
+  std::mutex writeLatch; //writers are serialized. readers are not
+  list<OptimisticLock *> latched; //held by the writer. iterators may latch any number of nodes
+  SuperFileStorage<TreeNode, int> treeNodeStorage; //int is the index of the root
+  FileStorage<LeafNode, int, LEAF_CACHE_SIZE> leafNodeStorage;
+  Key compactKey; //the last key copied by the running compaction
 
   NodePtr getPtr(int index, bool dirty) {
     if (index == -1) {
@@ -320,8 +386,165 @@ class PersistentSet { //use T as key
     return NodePtr(leafNodeStorage.get(index >> 1, dirty));
   }
 
+  //a snapshot reader sees the root as of its epoch
+  int rootIndex() {
+    if (Snapshot::reading()) {
+      bool first;
+      return *publishedVersions.read(published, first);
+    }
+    return dummy.children[0];
+  }
+
   NodePtr getRoot() {
-    return getPtr(dummy.children[0], true);
+    return getPtr(rootIndex(), false);
+  }
+
+  void publish() { //called at the end of every write
+    if (published != dummy.children[0]) {
+      publishedVersions.write(published);
+      published = dummy.children[0];
+    }
+  }
+
+  OptimisticLock &lockOf(NodePtr node) {
+    return node.isLeaf ? leafNodeStorage.lockOf(node.leafNode()) : treeNodeStorage.lockOf(node.treeNode());
+  }
+
+  //writers latch every node right before changing it, and release all latches when the operation ends
+  void latch(OptimisticLock &lock) {
+    for (size_t i = 0; i < latched.size(); i++) {
+      if (latched[i] == &lock) {
+        return;
+      }
+    }
+    lock.writeLock();
+    latched.push_back(&lock);
+  }
+
+  void modify(TreeNode *node) {
+    latch(node == &dummy ? rootLock : treeNodeStorage.modify(node));
+  }
+
+  void modify(LeafNode *node) {
+    latch(leafNodeStorage.modify(node));
+  }
+
+  void unlatch() {
+    while (!latched.empty()) {
+      latched.back()->writeUnlock();
+      latched.pop_back();
+    }
+  }
+
+  //find the leaf which may hold val with optimistic lock coupling: the version of a node is checked again
+  //after the version of its child is taken. return false if a writer got in the way
+  bool descend(const T &val, LeafNode *&leaf, unsigned long long &leafVersion) {
+    OptimisticLock *lock = &rootLock;
+    unsigned long long version;
+    if (!lock->readLock(version)) {
+      return false;
+    }
+    Key key(val);
+    int index = dummy.children[0];
+    while (true) {
+      if (!lock->validate(version)) {
+        return false;
+      }
+      NodePtr child = getPtr(index, false);
+      OptimisticLock *childLock = &lockOf(child);
+      unsigned long long childVersion;
+      if (!childLock->readLock(childVersion) || !lock->validate(version)) {
+        return false;
+      }
+      if (child.isLeaf) {
+        leaf = child.leafNode();
+        leafVersion = childVersion;
+        return true;
+      }
+      TreeNode *node = child.treeNode();
+      int size = node->size < 1 ? 1 : node->size > SIZE_1 ? SIZE_1 : node->size; //may be torn
+      index = node->children[node->index.upperBound(size - 1, key)];
+      lock = childLock;
+      version = childVersion;
+    }
+  }
+
+  //hint the storage to read the count leaves after leaf, but for the first skip, which were hinted before. the leaves
+  //are found from the tree nodes, which are in memory, rather than from the chain, which would need each one read in
+  //turn. iterators run in the writer or on a snapshot, so the nodes do not change meanwhile
+  void prefetch(LeafNode *leaf, int skip, int count) {
+    if (leaf->size == 0) {
+      return;
+    }
+    Key key(leaf->data[0]);
+    TreeNode *path[MAX_HEIGHT];
+    int pos[MAX_HEIGHT];
+    int height = 0;
+    int index = rootIndex();
+    while (index & 1) {
+      if (height == MAX_HEIGHT) {
+        return;
+      }
+      path[height] = treeNodeStorage.get(index >> 1, false);
+      pos[height] = path[height]->index.upperBound(path[height]->size - 1, key);
+      index = path[height]->children[pos[height]];
+      height++;
+    }
+    for (int i = 0; i < count; i++) { //step to the next leaf like an odometer
+      int h = height - 1;
+      while (h >= 0 && pos[h] + 1 >= path[h]->size) {
+        h--;
+      }
+      if (h < 0) {
+        return;
+      }
+      index = path[h]->children[++pos[h]];
+      while (++h < height) {
+        path[h] = treeNodeStorage.get(index >> 1, false);
+        pos[h] = 0;
+        index = path[h]->children[0];
+      }
+      if (i >= skip) {
+        leafNodeStorage.prefetch(index >> 1);
+      }
+    }
+  }
+
+  //the leaf whose range holds key, found from the tree nodes alone. in the writer thread
+  int leafOf(const Key &key) {
+    int index = dummy.children[0];
+    while (index & 1) {
+      TreeNode *node = treeNodeStorage.get(index >> 1, false);
+      index = node->children[node->index.upperBound(node->size - 1, key)];
+    }
+    return index;
+  }
+
+  //call f with a reference to every link to a leaf, from the tree nodes, which are in memory, or from dummy.
+  //the nodes holding them are marked as changed if modify is set
+  template<typename F>
+  void forEachLeafLink(bool modify, F f) {
+    if (!(dummy.children[0] & 1)) {
+      f(dummy.children[0]);
+      return;
+    }
+    list<int> nodes;
+    nodes.push_back(dummy.children[0] >> 1);
+    for (size_t i = 0; i < nodes.size(); i++) {
+      TreeNode *node = treeNodeStorage.get(nodes[i], false);
+      if (node->children[0] & 1) {
+        for (int j = 0; j < node->size; j++) {
+          nodes.push_back(node->children[j] >> 1);
+        }
+        continue;
+      }
+      if (modify) {
+        treeNodeStorage.modify(node);
+      }
+      for (int j = 0; j < node->size; j++) {
+        f(node->children[j]);
+      }
+    }
   }
 
   int add(const TreeNode &node) {
@@ -345,9 +568,87 @@ public:
                                                   leafNodeStorage(0, file_name + "_leaf") {
     dummy.size = 1;
     dummy.children[0] = treeNodeStorage.info == -1 ? add(LeafNode()) : treeNodeStorage.info;
+    published = dummy.children[0];
+  }
+
+  //write the whole tree back to its files. see NamedSnapshots
+  void checkpoint() {
+    unlatch();
+    treeNodeStorage.info = dummy.children[0];
+    treeNodeStorage.checkpoint();
+    leafNodeStorage.checkpoint();
+  }
+
+  //check the files against their checksums after checkpoint. return the number of bad records
+  int scrub() {
+    return treeNodeStorage.scrub() + leafNodeStorage.scrub();
+  }
+
+  //read the tree again after its files have changed underneath. no reader may be running
+  void reload() {
+    unlatch();
+    treeNodeStorage.reload();
+    leafNodeStorage.reload();
+    dummy.children[0] = treeNodeStorage.info;
+    published = dummy.children[0];
+    publishedVersions.collect(Snapshot::horizon());
   }
 
-  void checkCache() {
+  //online compaction: the leaves are copied in key order into a fresh file a few at a time between writes, and the
+  //copy then takes the place of the file, which scans then read front to back. see FileStorage::beginRewrite
+  void beginCompaction() {
+    leafNodeStorage.beginRewrite();
+    compactKey = Key();
+  }
+
+  void cancelCompaction() {
+    leafNodeStorage.cancelRewrite();
+  }
+
+  //copy leaves from where the last step stopped until budget bytes are spent, and return whether all are copied.
+  //the walk is picked up by key, since the leaf it stopped at may have been merged away meanwhile
+  bool compactStep(long long &budget) {
+    unlatch();
+    int index = leafOf(compactKey) >> 1;
+    while (budget > 0 && index != -1) {
+      LeafNode *leaf = leafNodeStorage.get(index, false);
+      budget -= sizeof(LeafNode);
+      if (leafNodeStorage.copied(index)) {
+        index = LeafNode::linkOf(*leaf);
+        continue;
+      }
+      if (leaf->size > 0) {
+        compactKey = Key(leaf->data[leaf->size - 1]);
+      }
+      index = leafNodeStorage.copy(index);
+      budget -= sizeof(LeafNode);
+    }
+    return index == -1;
+  }
+
+  //put the copy in place, after copying the leaves which the walk missed, if any. no reader may be running
+  void finishCompaction() {
+    unlatch();
+    forEachLeafLink(false, [this](int &link) {
+      if (!leafNodeStorage.copied(link >> 1)) {
+        leafNodeStorage.copy(link >> 1);
+      }
+    });
+    map<int, int> slots;
+    if (!leafNodeStorage.finishRewrite(slots)) {
+      return;
+    }
+    forEachLeafLink(true, [&slots](int &link) {
+      link = slots.at(link >> 1) << 1;
+    });
+    published = dummy.children[0];
+    publishedVersions.collect(Snapshot::horizon());
+  }
+
+  void checkCache() { //must not run alongside readers other than snapshot readers
+    unlatch();
+    publishedVersions.collect(Snapshot::horizon());
+    treeNodeStorage.checkCache();
     leafNodeStorage.checkCache();
   }
 
@@ -356,31 +657,97 @@ public:
   }
 
   bool insert(const T &val) {
-    bool ret = getRoot().insert(this, val, &dummy, 0);
+    std::lock_guard guard(writeLatch);
+    bool ret = getRoot().insert(this, val, Key(val), &dummy, 0);
     if (dummy.size == 2) {
       TreeNode newRoot;
       newRoot.size = 1;
       newRoot.children[0] = add(dummy);
       dummy = newRoot;
     }
+    publish();
+    unlatch();
     return ret;
   }
 
   bool erase(const T &val) {
-    bool ret = getRoot().erase(this, val, &dummy, 0);
+    std::lock_guard guard(writeLatch);
+    bool ret = getRoot().erase(this, val, Key(val), &dummy, 0);
+    if (dummy.size == 2) { //the root split on a longer separator
+      TreeNode newRoot;
+      newRoot.size = 1;
+      newRoot.children[0] = add(dummy);
+      dummy = newRoot;
+    }
     NodePtr root = getRoot();
     if (!root.isLeaf) {
       TreeNode rootNode = *root.treeNode();
       if (rootNode.size == 1) {
+        modify(&dummy);
+        modify(root.treeNode());
         remove(dummy.children[0]);
         dummy = rootNode;
       }
     }
+    publish();
+    unlatch();
     return ret;
   }
 
   iterator find(const T &val) { //return the iterator first no less than val
-    return getRoot().find(this, val);
+    return getRoot().find(this, val, Key(val));
+  }
+
+  //visit values no less than from in order until f returns false. may run in many threads alongside one writer:
+  //a leaf is copied and validated before its records are visited, and is looked up again if it changed meanwhile
+  template<typename F>
+  void scan(T from, F f) {
+    if (Snapshot::reading()) { //images never change
+      for (iterator it = find(from); !it.end(); ++it) {
+        if (!f(*it)) {
+          return;
+        }
+      }
+      return;
+    }
+    bool inclusive = true;
+    LeafNode copy;
+    while (true) {
+      LeafNode *leaf;
+      unsigned long long version;
+      if (!descend(from, leaf, version)) {
+        continue;
+      }
+      while (true) {
+        copy = *leaf;
+        if (!leafNodeStorage.lockOf(leaf).validate(version)) {
+          break;
+        }
+        T *first = inclusive ? lower_bound(copy.data, copy.data + copy.size, from)
+                             : upper_bound(copy.data, copy.data + copy.size, from);
+        for (T *it = first; it < copy.data + copy.size; it++) {
+          if (!f(*it)) {
+            return;
+          }
+        }
+        if (copy.size > 0) {
+          from = copy.data[copy.size - 1];
+          inclusive = false;
+        }
+        if (copy.next == -1) {
+          return;
+        }
+        //a leaf is only removed by merging it into its left neighbour, so next is valid while leaf is unchanged
+        LeafNode *next = getPtr(copy.next, false).leafNode();
+        unsigned long long nextVersion;
+        if (!leafNodeStorage.lockOf(next).readLock(nextVersion) || !leafNodeStorage.lockOf(leaf).validate(version)) {
+          break;
+        }
+        leafNodeStorage.prefetch(next->next >> 1); //may be torn, but it is only a hint
+        leaf = next;
+        version = nextVersion;
+      }
+    }
   }
 };
 
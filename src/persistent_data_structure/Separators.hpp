@@ -0,0 +1,172 @@
+#ifndef TICKETSYSTEM2024_SEPARATORS_HPP
+#define TICKETSYSTEM2024_SEPARATORS_HPP
+
+#include <cstring>
+#include "../util/KeyCoding.hpp"
+
+//the separators of a tree node, as byte strings (see KeyCoding) packed one after another. the bytes which every key
+//under the node starts with are stored once in front (prefix truncation). the prefix is taken from the separators
+//around the node in its parent, which bound every key that may ever reach it, so a separator inserted later has it
+//too. separators made from two leaves are cut after the first byte in which they differ (suffix truncation)
+template<typename INDEX, int COUNT, int BYTES>
+struct Separators {
+  static constexpr int MAX_KEY = sizeof(INDEX);
+
+  static_assert(BYTES >= 8 * MAX_KEY && BYTES < 65536, "BYTES must hold a few keys and fit in an unsigned short");
+
+  typedef KeyBytes<MAX_KEY> Key;
+
+  unsigned short prefix = 0; //the length of the prefix at the start of bytes
+  unsigned short ends[COUNT]; //where separator i ends in bytes. it starts where separator i-1 ends, or after the prefix
+  unsigned char bytes[BYTES];
+
+  int begin(int i) const {
+    return i == 0 ? prefix : ends[i - 1];
+  }
+
+  int used(int count) const {
+    return count == 0 ? prefix : ends[count - 1];
+  }
+
+  //whether the longest key might not fit any more
+  bool crowded(int count) const {
+    return used(count) > BYTES - MAX_KEY;
+  }
+
+  Key get(int i) const {
+    Key ret;
+    int b = begin(i);
+    memcpy(ret.bytes, bytes, prefix);
+    memcpy(ret.bytes + prefix, bytes + b, ends[i] - b);
+    ret.length = prefix + ends[i] - b;
+    return ret;
+  }
+
+  void getAll(int count, Key *keys) const {
+    for (int i = 0; i < count; i++) {
+      keys[i] = get(i);
+    }
+  }
+
+  //the number of separators no greater than key, like upper_bound. readers may see a node while it changes,
+  //so count and the offsets are only trusted as far as they stay within the node
+  int upperBound(int count, const Key &key) const {
+    int p = prefix < MAX_KEY ? prefix : MAX_KEY;
+    int c = memcmp(key.bytes, bytes, key.length < p ? key.length : p);
+    if (c < 0 || (c == 0 && key.length < p)) {
+      return 0;
+    }
+    if (c > 0) {
+      return count;
+    }
+    const unsigned char *rest = key.bytes + p;
+    int restLength = key.length - p;
+    int first = 0;
+    int n = count;
+    while (n > 0) {
+      int half = n / 2;
+      int mid = first + half;
+      int e = ends[mid] < BYTES ? ends[mid] : BYTES;
+      int b = mid == 0 ? p : ends[mid - 1];
+      b = b < e ? b : e;
+      if (Key::compare(bytes + b, e - b, rest, restLength) <= 0) {
+        first = mid + 1;
+        n -= half + 1;
+      } else {
+        n = half;
+      }
+    }
+    return first;
+  }
+
+  void insert(int count, int i, const Key &key) { //key must start with the prefix
+    int length = key.length - prefix;
+    int b = begin(i);
+    memmove(bytes + b + length, bytes + b, used(count) - b);
+    memcpy(bytes + b, key.bytes + prefix, length);
+    memmove(ends + i + 1, ends + i, (count - i) * sizeof(unsigned short));
+    ends[i] = b;
+    for (int j = i; j <= count; j++) {
+      ends[j] += length;
+    }
+  }
+
+  void erase(int count, int i) {
+    int b = begin(i);
+    int length = ends[i] - b;
+    memmove(bytes + b, bytes + ends[i], used(count) - ends[i]);
+    memmove(ends + i, ends + i + 1, (count - i - 1) * sizeof(unsigned short));
+    for (int j = i; j < count - 1; j++) {
+      ends[j] -= length;
+    }
+  }
+
+  void replace(int count, int i, const Key &key) { //key must start with the prefix
+    int b = begin(i);
+    int length = key.length - prefix;
+    int grown = length - (ends[i] - b);
+    if (grown != 0) {
+      memmove(bytes + ends[i] + grown, bytes + ends[i], used(count) - ends[i]);
+      for (int j = i; j < count; j++) {
+        ends[j] += grown;
+      }
+    }
+    memcpy(bytes + b, key.bytes + prefix, length);
+  }
+
+  //the length of a prefix which every key under children first to last shares. the separators around them bound
+  //those keys, and at the edges of the node its own prefix stands in
+  int prefixOf(int count, int first, int last) const {
+    if (first == 0 || last == count) {
+      return prefix;
+    }
+    return get(first - 1).commonPrefix(get(last));
+  }
+
+  //the length of the prefix which this node and rhs share
+  int commonPrefix(const Separators &rhs) const {
+    int n = prefix < rhs.prefix ? prefix : rhs.prefix;
+    int i = 0;
+    while (i < n && bytes[i] == rhs.bytes[i]) {
+      i++;
+    }
+    return i;
+  }
+
+  //where to cut count separators, all starting with the first prefixLength bytes, so that both sides hold about as
+  //many bytes: the number of children left of the cut
+  static int middle(const Key *keys, int count, int prefixLength) {
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+      total += keys[i].length - prefixLength;
+    }
+    int kept = 1;
+    for (int sum = keys[0].length - prefixLength; kept < count && sum < total / 2; kept++) {
+      sum += keys[kept].length - prefixLength;
+    }
+    return kept;
+  }
+
+  static bool fits(const Key *keys, int count, int prefixLength) {
+    int size = prefixLength;
+    for (int i = 0; i < count; i++) {
+      size += keys[i].length - prefixLength;
+    }
+    return size <= BYTES - MAX_KEY;
+  }
+
+  void assign(const Key *keys, int count, int prefixLength) { //every key must start with the first prefixLength bytes
+    prefix = count == 0 ? 0 : prefixLength;
+    if (count > 0) {
+      memcpy(bytes, keys[0].bytes, prefix);
+    }
+    int end = prefix;
+    for (int i = 0; i < count; i++) {
+      memcpy(bytes + end, keys[i].bytes + prefix, keys[i].length - prefix);
+      end += keys[i].length - prefix;
+      ends[i] = end;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef TICKETSYSTEM2024_BINARY_PROTOCOL_HPP
+#define TICKETSYSTEM2024_BINARY_PROTOCOL_HPP
+
+#include "Response.hpp"
+#include "../Command.hpp"
+
+//length-prefixed binary protocol for internal callers. integers are in host byte order
+//request:  u32 length | u32 timestamp | u8 opcode | u32 presence mask | present fields in schema order
+//response: u32 length | u32 timestamp | records, each a u8 tag followed by its payload
+//length counts the bytes after itself
+namespace BinaryProtocol {
+  //fields are pairs of parameter key and type:
+  //S string (u16 length + bytes), I i32, D u8 date index, T u32 interned station id, B u8 flag
+  //add_train keeps its list parameters as strings in the text format
+  struct Schema {
+    const char *name;
+    const char *fields;
+  };
+
+  constexpr Schema schemas[] = {
+    {"", ""},
+    {"add_user", "cSuSpSnSmSgI"},
+    {"login", "uSpS"},
+    {"logout", "uS"},
+    {"query_profile", "cSuS"},
+    {"modify_profile", "cSuSpSnSmSgI"},
+    {"add_train", "iSnImIsSpSxStSoSdSyS"},
+    {"delete_train", "iS"},
+    {"release_train", "iS"},
+    {"query_train", "iSdD"},
+    {"buy_ticket", "uSiSdDnIfTtTqB"},
+    {"query_order", "uS"},
+    {"query_ticket", "sTtTdDpB"}, //p is set for cost
+    {"refund_ticket", "uSnI"},
+    {"query_transfer", "sTtTdDpB"},
+    {"query_station", "sS"},
+    {"clean", ""},
+    {"exit", ""},
+    {"stats", "eBfStS"},
+    {"create_snapshot", "iS"},
+    {"restore_snapshot", "iS"},
+    {"delete_snapshot", "iS"},
+    {"scrub", "iS"}, //i is the snapshot to restore if a record is corrupt
+    {"compact", "rI"}, //r is the rate in MiB a second
+    {"freeze", "dD"}, //d is the first day which stays on sale
+  };
+  constexpr int SCHEMA_COUNT = sizeof(schemas) / sizeof(Schema);
+  //no well-formed request comes near this. a longer frame is skipped unread
+  constexpr unsigned MAX_FRAME = 1 << 18;
+
+  enum Tag : unsigned char {
+    CODE = 1, QUEUED, BYE, COUNT, ACCOUNT, TRAIN, STOP, LINE, ORDER, TEXT //TEXT is a u32 length and bytes
+  };
+
+  struct AccountRecord {
+    String20 userID;
+    String20 name;
+    String30 mailAddr;
+    int privilege;
+  };
+
+  struct TrainRecord {
+    String20 trainID;
+    char type;
+  };
+
+  struct StopRecord {
+    String40 station;
+    Chrono arrival; //time < 0 for the start station
+    Chrono departure; //time < 0 for the terminal
+    int price;
+    int seat; //-1 for the terminal
+  };
+
+  class Reader {
+    const char *ptr;
+    const char *last;
+
+  public:
+    Reader(const char *ptr, int length) : ptr(ptr), last(ptr + length) {}
+
+    template<typename T>
+    bool read(T &x) {
+      if (last - ptr < (long) sizeof(T)) {
+        return false;
+      }
+      memcpy(&x, ptr, sizeof(T));
+      ptr += sizeof(T);
+      return true;
+    }
+
+    bool read(std::string &s) {
+      unsigned short length;
+      if (!read(length) || last - ptr < length) {
+        return false;
+      }
+      s.assign(ptr, length);
+      ptr += length;
+      return true;
+    }
+  };
+
+  //decode the next request. return false at end of input
+  //a malformed frame yields a command with an empty name, which is answered with -1
+  bool readCommand(std::istream &in, Command &command) {
+    unsigned length;
+    if (!in.read(reinterpret_cast<char *>(&length), sizeof(length))) {
+      return false;
+    }
+    if (length > MAX_FRAME) {
+      command = Command();
+      in.ignore(length);
+      return in.gcount() == length; //short of the frame's end is the end of input
+    }
+    std::string buffer(length, '\0');
+    if (!in.read(buffer.data(), length)) {
+      return false;
+    }
+    command = Command();
+    Reader reader(buffer.data(), length);
+    unsigned char opcode;
+    unsigned mask;
+    if (!reader.read(command.stamp) || !reader.read(opcode) || !reader.read(mask) || opcode >= SCHEMA_COUNT) {
+      return true;
+    }
+    for (const char *p = schemas[opcode].fields; *p; p += 2) {
+      char key = p[0];
+      if (!(mask >> (key - 'a') & 1)) {
+        continue;
+      }
+      bool ok;
+      if (p[1] == 'S') {
+        ok = reader.read(command.params[key - 'a']);
+      } else if (p[1] == 'I' || p[1] == 'T') {
+        int x;
+        ok = reader.read(x);
+        command.setValue(key, x);
+      } else {
+        unsigned char x;
+        ok = reader.read(x);
+        command.setValue(key, x);
+      }
+      if (!ok) {
+        return true;
+      }
+    }
+    command.name = schemas[opcode].name;
+    return true;
+  }
+}
+
+class BinaryResponse : public Response {
+  std::ostream &out;
+  std::string buffer;
+  int stamp = 0;
+
+  template<typename T>
+  void put(BinaryProtocol::Tag tag, const T &x) {
+    buffer.push_back(tag);
+    buffer.append(reinterpret_cast<const char *>(&x), sizeof(T));
+  }
+
+public:
+  explicit BinaryResponse(std::ostream &out) : out(out) {}
+
+  void begin(const Command &command) override {
+    buffer.clear();
+    stamp = command.stamp;
+  }
+
+  void end() override {
+    unsigned length = sizeof(stamp) + buffer.size();
+    out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.write(reinterpret_cast<const char *>(&stamp), sizeof(stamp));
+    out.write(buffer.data(), buffer.size());
+    out.flush(); //callers wait for the response before sending the next request
+  }
+
+  void code(int x) override {
+    put(BinaryProtocol::CODE, x);
+  }
+
+  void queued() override {
+    buffer.push_back(BinaryProtocol::QUEUED);
+  }
+
+  void bye() override {
+    buffer.push_back(BinaryProtocol::BYE);
+  }
+
+  void count(int n) override {
+    put(BinaryProtocol::COUNT, n);
+  }
+
+  void account(const Account &account) override {
+    put(BinaryProtocol::ACCOUNT,
+        BinaryProtocol::AccountRecord{account.userID, account.name, account.mailAddr, account.privilege});
+  }
+
+  void train(const String20 &trainID, char type) override {
+    put(BinaryProtocol::TRAIN, BinaryProtocol::TrainRecord{trainID, type});
+  }
+
+  void stop(const String40 &station, const Chrono &arrival, const Chrono &departure, int price, int seat) override {
+    put(BinaryProtocol::STOP, BinaryProtocol::StopRecord{station, arrival, departure, price, seat});
+  }
+
+  void line(const Line &line) override {
+    put(BinaryProtocol::LINE, line);
+  }
+
+  void order(const Order &order) override {
+    put(BinaryProtocol::ORDER, order);
+  }
+
+  void text(const std::string &s) override {
+    put(BinaryProtocol::TEXT, (unsigned) s.size());
+    buffer.append(s);
+  }
+};
+
+#endif
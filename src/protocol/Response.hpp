@@ -0,0 +1,42 @@
+#ifndef TICKETSYSTEM2024_RESPONSE_HPP
+#define TICKETSYSTEM2024_RESPONSE_HPP
+
+#include "../util/Util.hpp"
+
+struct Command;
+struct Account;
+struct Line;
+struct Order;
+
+//sink of command results. handlers report typed values and each protocol decides how to render them
+class Response {
+public:
+  virtual ~Response() = default;
+
+  virtual void begin(const Command &command) = 0;
+
+  virtual void end() = 0;
+
+  virtual void code(int x) = 0; //0 and -1 for success and failure, or a plain integer result such as a price
+
+  virtual void queued() = 0;
+
+  virtual void bye() = 0;
+
+  virtual void count(int n) = 0; //number of records that follow
+
+  virtual void account(const Account &account) = 0;
+
+  virtual void train(const String20 &trainID, char type) = 0;
+
+  //one station of query_train. seat < 0 for the terminal
+  virtual void stop(const String40 &station, const Chrono &arrival, const Chrono &departure, int price, int seat) = 0;
+
+  virtual void line(const Line &line) = 0;
+
+  virtual void order(const Order &order) = 0;
+
+  virtual void text(const std::string &s) = 0; //free-form report such as stats
+};
+
+#endif
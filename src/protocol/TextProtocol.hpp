@@ -0,0 +1,87 @@
+#ifndef TICKETSYSTEM2024_TEXT_PROTOCOL_HPP
+#define TICKETSYSTEM2024_TEXT_PROTOCOL_HPP
+
+#include "Response.hpp"
+#include "../Command.hpp"
+
+//render results in the format of management_system.md. records are separated by line breaks
+class TextResponse : public Response {
+  std::ostream &out;
+  bool fresh = true; //no line break before the first record
+
+  void next() {
+    if (!fresh) {
+      out << '\n';
+    }
+    fresh = false;
+  }
+
+public:
+  explicit TextResponse(std::ostream &out) : out(out) {}
+
+  void begin(const Command &command) override {
+    out << command.timestamp << ' ';
+    fresh = true;
+  }
+
+  void end() override {
+    out << '\n';
+  }
+
+  void code(int x) override {
+    next();
+    out << x;
+  }
+
+  void queued() override {
+    next();
+    out << "queue";
+  }
+
+  void bye() override {
+    next();
+    out << "bye";
+  }
+
+  void count(int n) override {
+    next();
+    out << n;
+  }
+
+  void account(const Account &account) override {
+    next();
+    out << account;
+  }
+
+  void train(const String20 &trainID, char type) override {
+    next();
+    out << trainID << ' ' << type;
+  }
+
+  void stop(const String40 &station, const Chrono &arrival, const Chrono &departure, int price, int seat) override {
+    next();
+    out << station << ' ' << arrival << " -> " << departure << ' ' << price << ' ';
+    if (seat < 0) {
+      out << 'x';
+    } else {
+      out << seat;
+    }
+  }
+
+  void line(const Line &line) override {
+    next();
+    out << line;
+  }
+
+  void order(const Order &order) override {
+    next();
+    out << order;
+  }
+
+  void text(const std::string &s) override {
+    next();
+    out << s;
+  }
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef TICKETSYSTEM2024_CRC32C_HPP
+#define TICKETSYSTEM2024_CRC32C_HPP
+
+#include <cstddef>
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+//crc32c (castagnoli), the checksum of the stored records. x86 has an instruction for it since sse4.2, which the
+//build does not assume, so the instruction is picked at run time and a table is used where it is missing
+namespace Crc32c {
+  constexpr unsigned POLYNOMIAL = 0x82f63b78; //reflected
+
+  struct Table {
+    unsigned entries[256];
+
+    constexpr Table() : entries() {
+      for (unsigned i = 0; i < 256; i++) {
+        unsigned crc = i;
+        for (int j = 0; j < 8; j++) {
+          crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+        }
+        entries[i] = crc;
+      }
+    }
+  };
+
+  constexpr Table TABLE;
+
+  unsigned software(unsigned crc, const unsigned char *p, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      crc = TABLE.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+  }
+
+#if defined(__x86_64__)
+  __attribute__((target("sse4.2"))) unsigned hardware(unsigned crc, const unsigned char *p, size_t size) {
+    unsigned long long wide = crc;
+    for (; size >= 8; size -= 8, p += 8) {
+      unsigned long long word;
+      memcpy(&word, p, 8);
+      wide = _mm_crc32_u64(wide, word);
+    }
+    crc = (unsigned) wide;
+    for (; size > 0; size--) {
+      crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+  }
+
+  const bool HARDWARE = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+unsigned crc32c(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+#if defined(__x86_64__)
+  if (Crc32c::HARDWARE) {
+    return ~Crc32c::hardware(~0u, p, size);
+  }
+#endif
+  return ~Crc32c::software(~0u, p, size);
+}
+
+#endif
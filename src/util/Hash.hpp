@@ -0,0 +1,21 @@
+#ifndef TICKETSYSTEM2024_HASH_HPP
+#define TICKETSYSTEM2024_HASH_HPP
+
+#include <cstddef>
+
+//64-bit FNV-1a over raw bytes. keys are plain structs of fixed strings and ints, so their bytes identify them
+unsigned long long hashBytes(const void *data, size_t size, unsigned long long seed = 14695981039346656037ULL) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  unsigned long long h = seed;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+template<typename T>
+unsigned long long hashOf(const T &value) {
+  return hashBytes(&value, sizeof(T));
+}
+
+#endif
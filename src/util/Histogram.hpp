@@ -0,0 +1,103 @@
+#ifndef TICKETSYSTEM2024_HISTOGRAM_HPP
+#define TICKETSYSTEM2024_HISTOGRAM_HPP
+
+#include <cmath>
+
+//HDR-style histogram of non-negative integers (e.g. nanoseconds)
+//log-linear buckets: each power of 2 is split into SUB_COUNT buckets, so the relative error is below 1/SUB_COUNT
+//recording is a few instructions and never allocates
+class Histogram {
+  static constexpr int SUB_BITS = 5;
+  static constexpr int SUB_COUNT = 1 << SUB_BITS;
+  static constexpr int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+  unsigned long long counts[BUCKET_COUNT]{};
+  unsigned long long total = 0;
+  unsigned long long sum = 0;
+  unsigned long long minValue = ~0ull;
+  unsigned long long maxValue = 0;
+
+  static int bucketOf(unsigned long long v) {
+    if (v < SUB_COUNT) {
+      return (int) v;
+    }
+    int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int) (v >> shift) - SUB_COUNT;
+  }
+
+  static unsigned long long highestOf(int bucket) { //the largest value falling into bucket
+    if (bucket < SUB_COUNT) {
+      return bucket;
+    }
+    int shift = bucket / SUB_COUNT - 1;
+    return ((unsigned long long) (SUB_COUNT + bucket % SUB_COUNT + 1) << shift) - 1;
+  }
+
+public:
+  void record(unsigned long long v) {
+    counts[bucketOf(v)]++;
+    total++;
+    sum += v;
+    if (v < minValue) {
+      minValue = v;
+    }
+    if (v > maxValue) {
+      maxValue = v;
+    }
+  }
+
+  void merge(const Histogram &other) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if (other.minValue < minValue) {
+      minValue = other.minValue;
+    }
+    if (other.maxValue > maxValue) {
+      maxValue = other.maxValue;
+    }
+  }
+
+  void clear() {
+    *this = Histogram();
+  }
+
+  unsigned long long count() const {
+    return total;
+  }
+
+  unsigned long long min() const {
+    return total ? minValue : 0;
+  }
+
+  unsigned long long max() const {
+    return maxValue;
+  }
+
+  double mean() const {
+    return total ? (double) sum / total : 0;
+  }
+
+  //the smallest recorded value v such that at least q of the records are no more than v (up to bucket precision)
+  unsigned long long percentile(double q) const {
+    if (total == 0) {
+      return 0;
+    }
+    unsigned long long target = (unsigned long long) ceil(q * total);
+    if (target == 0) {
+      target = 1;
+    }
+    unsigned long long seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+      seen += counts[i];
+      if (seen >= target) {
+        unsigned long long v = highestOf(i);
+        return v < maxValue ? v : maxValue;
+      }
+    }
+    return maxValue;
+  }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TICKETSYSTEM2024_KEY_CODING_HPP
+#define TICKETSYSTEM2024_KEY_CODING_HPP
+
+#include <bit>
+#include <cstring>
+#include <type_traits>
+#include "Util.hpp"
+
+//keys written as byte strings which compare with memcmp, shorter first on a tie, in the same order as the keys
+//themselves. a string is cut after its terminating zero, since names are zero padded, and ints are big-endian with
+//the sign bit flipped. struct keys encode their members in the order their <=> compares them. no encoding is a
+//prefix of another of the same type, and none is longer than the key
+
+inline void encodeKey(unsigned char *&out, int x) {
+  unsigned int u = (unsigned int) x ^ 0x80000000u;
+  out[0] = u >> 24;
+  out[1] = u >> 16;
+  out[2] = u >> 8;
+  out[3] = u;
+  out += 4;
+}
+
+template<int L>
+void encodeKey(unsigned char *&out, const FixedString<L> &s) {
+  const char *p = s.data();
+  for (int i = 0; i < L; i++) { //chars compare signed where char is signed
+    *out++ = std::is_signed_v<char> ? (unsigned char) p[i] ^ 0x80 : (unsigned char) p[i];
+    if (p[i] == '\0') {
+      break;
+    }
+  }
+}
+
+template<typename T1, typename T2>
+void encodeKey(unsigned char *&out, const pair<T1, T2> &p) {
+  encodeKey(out, p.first);
+  encodeKey(out, p.second);
+}
+
+template<int MAX>
+struct KeyBytes {
+  int length = 0;
+  unsigned char bytes[MAX];
+
+  KeyBytes() = default;
+
+  template<typename T>
+  explicit KeyBytes(const T &key) {
+    unsigned char *out = bytes;
+    encodeKey(out, key);
+    length = out - bytes;
+  }
+
+  //8 bytes are checked at a time for the first difference, like FixedString
+  static int compare(const unsigned char *a, int aLength, const unsigned char *b, int bLength) {
+    int n = aLength < bLength ? aLength : bLength;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+      unsigned long long x, y;
+      memcpy(&x, a + i, 8);
+      memcpy(&y, b + i, 8);
+      if (x != y) {
+        int j = i + (std::endian::native == std::endian::little ? __builtin_ctzll(x ^ y) : __builtin_clzll(x ^ y)) / 8;
+        return a[j] - b[j];
+      }
+    }
+    for (; i < n; i++) {
+      if (a[i] != b[i]) {
+        return a[i] - b[i];
+      }
+    }
+    return aLength - bLength;
+  }
+
+  int compare(const KeyBytes &rhs) const {
+    return compare(bytes, length, rhs.bytes, rhs.length);
+  }
+
+  int commonPrefix(const KeyBytes &rhs) const {
+    int n = length < rhs.length ? length : rhs.length;
+    int i = 0;
+    while (i < n && bytes[i] == rhs.bytes[i]) {
+      i++;
+    }
+    return i;
+  }
+
+  //the shortest byte string s with left < s <= right, for left < right: right cut after the first byte they differ in
+  static KeyBytes separator(const KeyBytes &left, const KeyBytes &right) {
+    KeyBytes ret = right;
+    ret.length = left.commonPrefix(right) + 1;
+    return ret;
+  }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef TICKETSYSTEM2024_LZ_HPP
+#define TICKETSYSTEM2024_LZ_HPP
+
+#include <cstring>
+
+//block compression in the manner of lz4, for records which are read far more often than written. a block is a run of
+//sequences, each a token, literals, and a match: the token holds the number of literals in its high four bits and the
+//match length less MIN_MATCH in its low four, 15 meaning that bytes follow which are added up to the last one below
+//255. the literals are copied as they are, then the match is copied from the 2-byte little-endian offset back in the
+//output. the last sequence has literals only. matches are found through a table of the last position of each hash of
+//4 bytes, so compression is a single pass, and decompression is little more than copies
+namespace Lz {
+  constexpr int MIN_MATCH = 4;
+  constexpr int LAST_LITERALS = 5; //a match ends that far before the end of the block at least
+  constexpr int MATCH_LIMIT = 12; //and starts that far before it
+  constexpr int MAX_OFFSET = 65535;
+  constexpr int HASH_BITS = 12;
+  constexpr int SKIP_BITS = 6; //the step through bytes without matches grows every 1 << SKIP_BITS of them
+  constexpr int WIDE = 16; //literals copied at once when there is room, however many there are
+
+  inline unsigned load32(const unsigned char *p) {
+    unsigned ret;
+    memcpy(&ret, p, 4);
+    return ret;
+  }
+
+  inline int hash(unsigned sequence) {
+    return (int) ((sequence * 2654435761u) >> (32 - HASH_BITS));
+  }
+
+  inline unsigned char *writeLength(unsigned char *out, int length) {
+    for (; length >= 255; length -= 255) {
+      *out++ = 255;
+    }
+    *out++ = (unsigned char) length;
+    return out;
+  }
+
+  inline unsigned char *writeSequence(unsigned char *out, const unsigned char *literals, int literalCount,
+                                      int offset, int matchLength) {
+    unsigned char *token = out++;
+    int match = matchLength ? matchLength - MIN_MATCH : 0; //none in the last sequence
+    *token = (unsigned char) ((literalCount < 15 ? literalCount : 15) << 4 | (match < 15 ? match : 15));
+    if (literalCount >= 15) {
+      out = writeLength(out, literalCount - 15);
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (matchLength == 0) {
+      return out;
+    }
+    *out++ = (unsigned char) (offset & 0xff);
+    *out++ = (unsigned char) (offset >> 8);
+    if (match >= 15) {
+      out = writeLength(out, match - 15);
+    }
+    return out;
+  }
+
+  //read a length continued past 15. false if it runs off the end
+  inline bool readLength(const unsigned char *&in, const unsigned char *end, int &length) {
+    unsigned char byte;
+    do {
+      if (in == end) {
+        return false;
+      }
+      byte = *in++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  }
+}
+
+//the most bytes lzCompress may write for size bytes
+int lzBound(int size) {
+  return size + size / 255 + 16;
+}
+
+//compress size bytes of src into dst, which must hold lzBound(size) bytes. return the compressed size
+int lzCompress(const void *src, int size, void *dst) {
+  using namespace Lz;
+  const unsigned char *begin = static_cast<const unsigned char *>(src), *end = begin + size;
+  unsigned char *out = static_cast<unsigned char *>(dst);
+  int table[1 << HASH_BITS]; //position + 1 of the last sequence with each hash, 0 for none
+  memset(table, 0, sizeof(table));
+  const unsigned char *anchor = begin; //the first byte not yet written
+  const unsigned char *p = begin;
+  const unsigned char *limit = size > MATCH_LIMIT ? end - MATCH_LIMIT : begin;
+  while (p < limit) {
+    unsigned sequence = load32(p);
+    int h = hash(sequence);
+    int candidate = table[h] - 1;
+    table[h] = (int) (p - begin) + 1;
+    const unsigned char *match = begin + (candidate < 0 ? 0 : candidate);
+    if (candidate < 0 || p - match > MAX_OFFSET || load32(match) != sequence) {
+      p += 1 + ((p - anchor) >> SKIP_BITS);
+      continue;
+    }
+    while (p > anchor && match > begin && p[-1] == match[-1]) {
+      p--;
+      match--;
+    }
+    const unsigned char *q = p + MIN_MATCH;
+    const unsigned char *m = match + MIN_MATCH;
+    while (q < end - LAST_LITERALS && *q == *m) {
+      q++;
+      m++;
+    }
+    out = writeSequence(out, anchor, (int) (p - anchor), (int) (p - match), (int) (q - p));
+    p = anchor = q;
+  }
+  out = writeSequence(out, anchor, (int) (end - anchor), 0, 0);
+  return (int) (out - static_cast<unsigned char *>(dst));
+}
+
+//decompress size bytes of src into dst, which holds capacity bytes. return the decompressed size, or -1 if src is not
+//a block lzCompress could have made, or would not fit
+int lzDecompress(const void *src, int size, void *dst, int capacity) {
+  using namespace Lz;
+  const unsigned char *in = static_cast<const unsigned char *>(src), *inEnd = in + size;
+  unsigned char *begin = static_cast<unsigned char *>(dst), *out = begin, *outEnd = begin + capacity;
+  while (in < inEnd) {
+    int token = *in++;
+    int literals = token >> 4;
+    if (literals == 15 && !readLength(in, inEnd, literals)) {
+      return -1;
+    }
+    if (literals > inEnd - in || literals > outEnd - out) {
+      return -1;
+    }
+    if (literals <= WIDE && inEnd - in >= WIDE && outEnd - out >= WIDE) { //most runs are short, so copy a fixed width
+      memcpy(out, in, WIDE);
+    } else {
+      memcpy(out, in, literals);
+    }
+    in += literals;
+    out += literals;
+    if (in == inEnd) {
+      break;
+    }
+    if (inEnd - in < 2) {
+      return -1;
+    }
+    int offset = in[0] | in[1] << 8;
+    in += 2;
+    int length = token & 15;
+    if (length == 15 && !readLength(in, inEnd, length)) {
+      return -1;
+    }
+    length += MIN_MATCH;
+    if (offset == 0 || offset > out - begin || length > outEnd - out) {
+      return -1;
+    }
+    const unsigned char *match = out - offset;
+    unsigned char *stop = out + length;
+    if (offset >= 8 && outEnd - stop >= 8) { //8 bytes at a time, each copy reading only bytes written before it
+      for (; out < stop; out += 8, match += 8) {
+        memcpy(out, match, 8);
+      }
+    } else if (offset == 1) { //a run of one byte, like the padding of strings
+      memset(out, out[-1], length);
+    } else { //the match overlaps what it writes, which repeats the last offset bytes
+      for (; out < stop; out++, match++) {
+        *out = *match;
+      }
+    }
+    out = stop;
+  }
+  return (int) (out - begin);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TICKETSYSTEM2024_OPTIMISTIC_LOCK_HPP
+#define TICKETSYSTEM2024_OPTIMISTIC_LOCK_HPP
+
+#include <atomic>
+#include <thread>
+
+//version latch for optimistic lock coupling
+//readers take no lock: they remember the version, read, and then check that the version is unchanged.
+//a writer holds the latch while it changes the protected data, and every release bumps the version
+class OptimisticLock {
+  static constexpr unsigned long long OBSOLETE = 1;
+  static constexpr unsigned long long LOCKED = 2;
+
+  std::atomic<unsigned long long> version{0};
+
+public:
+  //wait until no writer holds the latch. return false if the data has been removed
+  bool readLock(unsigned long long &v) const {
+    v = version.load(std::memory_order_acquire);
+    while (v & LOCKED) {
+      std::this_thread::yield();
+      v = version.load(std::memory_order_acquire);
+    }
+    return !(v & OBSOLETE);
+  }
+
+  //whether nothing has changed since readLock returned v
+  bool validate(unsigned long long v) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+  }
+
+  void writeLock() {
+    unsigned long long v = version.load(std::memory_order_relaxed);
+    while ((v & LOCKED) || !version.compare_exchange_weak(v, v + LOCKED, std::memory_order_acquire)) {
+      std::this_thread::yield();
+      v = version.load(std::memory_order_relaxed);
+    }
+  }
+
+  void writeUnlock() {
+    version.fetch_add(LOCKED, std::memory_order_release);
+  }
+
+  //readers holding an old version will find the data removed. the bit survives writeUnlock
+  void markObsolete() {
+    version.fetch_or(OBSOLETE, std::memory_order_release);
+  }
+
+  //the data is in use again after markObsolete. the version moves on, so old readers still fail to validate
+  void revive() {
+    unsigned long long v = version.load(std::memory_order_relaxed);
+    version.store((v & ~OBSOLETE) + 2 * LOCKED, std::memory_order_release);
+  }
+};
+
+#endif
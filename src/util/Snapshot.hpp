@@ -0,0 +1,224 @@
+#ifndef TICKETSYSTEM2024_SNAPSHOT_HPP
+#define TICKETSYSTEM2024_SNAPSHOT_HPP
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "../data_structure/list.hpp"
+
+//snapshot isolation for read-only commands, which run on other threads while the writer thread goes on.
+//changes are numbered by epochs, and registering a reader closes the running epoch. a reader sees the stores as of
+//its epoch: before the writer first changes a cached record in an epoch, the old image is kept if any reader is
+//registered, and a reader resolves each record to the newest image no later than its epoch
+namespace Snapshot {
+  constexpr unsigned long long NONE = ~0ULL;
+  constexpr int MAX_READERS = 64;
+
+  struct Slot {
+    std::atomic<unsigned long long> epoch{NONE}; //NONE if the slot is free
+    std::atomic<unsigned long long> ticket{0}; //registration order. tells whether the reader may hold an image
+  };
+
+  struct Horizon { //oldest epoch and ticket of the registered readers. NONE if there is none
+    unsigned long long epoch = NONE;
+    unsigned long long ticket = NONE;
+  };
+
+  Slot slots[MAX_READERS];
+  std::atomic<int> readerCount{0};
+  unsigned long long writing = 1; //epoch of the changes being made. only the writer thread uses it
+  unsigned long long tickets = 0;
+  thread_local unsigned long long current = NONE; //epoch read by this thread. NONE for the writer, which sees all
+  thread_local unsigned long long ticket = 0;
+
+  bool reading() {
+    return current != NONE;
+  }
+
+  bool active() {
+    return readerCount.load(std::memory_order_acquire) > 0;
+  }
+
+  //register a reader of everything written so far. must be called by the writer thread between two writes
+  //return the slot, or -1 if all are taken
+  int begin() {
+    for (int i = 0; i < MAX_READERS; i++) {
+      if (slots[i].epoch.load(std::memory_order_acquire) == NONE) {
+        slots[i].ticket.store(++tickets, std::memory_order_relaxed);
+        slots[i].epoch.store(writing++, std::memory_order_release);
+        readerCount.fetch_add(1, std::memory_order_release);
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void end(int slot) {
+    readerCount.fetch_sub(1, std::memory_order_release);
+    slots[slot].epoch.store(NONE, std::memory_order_release);
+  }
+
+  Horizon horizon() {
+    Horizon ret;
+    for (int i = 0; i < MAX_READERS; i++) {
+      unsigned long long epoch = slots[i].epoch.load(std::memory_order_acquire);
+      if (epoch != NONE) {
+        ret.epoch = std::min(ret.epoch, epoch);
+        ret.ticket = std::min(ret.ticket, slots[i].ticket.load(std::memory_order_relaxed));
+      }
+    }
+    return ret;
+  }
+
+  //run the calling thread as the reader registered in slot
+  class Reader {
+  public:
+    explicit Reader(int slot) {
+      current = slots[slot].epoch.load(std::memory_order_acquire);
+      ticket = slots[slot].ticket.load(std::memory_order_relaxed);
+    }
+
+    ~Reader() {
+      current = NONE;
+    }
+  };
+}
+
+//older images of a cached record, kept for snapshot readers. lives in the cache frame next to the record
+template<typename T>
+class Versions {
+  struct Image {
+    T data;
+    unsigned long long epoch; //when the record became data
+    unsigned long long ticket; //the latest reader which has been handed the image
+    Image *older;
+  };
+
+  std::atomic<bool> busy{false};
+  unsigned long long epoch = 0; //when the record was last changed. records loaded from file are older than any reader
+  Image *images = nullptr; //newest first
+
+  void lock() {
+    while (busy.exchange(true, std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void unlock() {
+    busy.store(false, std::memory_order_release);
+  }
+
+public:
+  Versions() = default;
+
+  Versions(const Versions &) = delete;
+
+  Versions &operator=(const Versions &) = delete;
+
+  ~Versions() {
+    while (images) {
+      Image *older = images->older;
+      delete images;
+      images = older;
+    }
+  }
+
+  bool empty() const {
+    return images == nullptr;
+  }
+
+  //must be called by the writer before it changes record. return true if the first image is made,
+  //so that the store lists the frame for collect
+  bool write(const T &record) {
+    if (epoch == Snapshot::writing) {
+      return false;
+    }
+    bool first = false;
+    lock();
+    if (Snapshot::active() && (!images || images->epoch != epoch)) {
+      first = !images;
+      images = new Image{record, epoch, 0, images};
+    }
+    epoch = Snapshot::writing;
+    unlock();
+    return first;
+  }
+
+  //record as seen by the reader of the calling thread. first is set as the return value of write
+  T *read(const T &record, bool &first) {
+    lock();
+    first = false;
+    if (epoch <= Snapshot::current && (!images || images->epoch != epoch)) { //the record is stable, copy it once
+      first = !images;
+      images = new Image{record, epoch, 0, images};
+    }
+    Image *image = images;
+    while (image && image->epoch > Snapshot::current) {
+      image = image->older;
+    }
+    if (image) {
+      image->ticket = std::max(image->ticket, Snapshot::ticket);
+    }
+    unlock();
+    return image ? &image->data : const_cast<T *>(&record);
+  }
+
+  //drop the images which no registered reader may resolve to or still hold. return whether any is left
+  bool collect(const Snapshot::Horizon &horizon) {
+    lock();
+    unsigned long long next = epoch; //when the state after the image began
+    Image **p = &images;
+    while (*p) {
+      Image *image = *p;
+      bool copy = p == &images && image->epoch == epoch; //a copy of the record, which can be made again
+      bool needed = (!copy && horizon.epoch < next) || (horizon.ticket != Snapshot::NONE && image->ticket >= horizon.ticket);
+      next = image->epoch;
+      if (needed) {
+        p = &image->older;
+      } else {
+        *p = image->older;
+        delete image;
+      }
+    }
+    bool ret = images != nullptr;
+    unlock();
+    return ret;
+  }
+};
+
+//frames of a store which hold images, so that checkCache can drop the images nobody needs any more
+template<typename Frame>
+class VersionedFrames {
+  std::mutex latch;
+  list<Frame *> frames;
+
+public:
+  void add(Frame *frame) {
+    std::lock_guard guard(latch);
+    frames.push_back(frame);
+  }
+
+  //forget every frame, when the store drops its cache
+  void clear() {
+    std::lock_guard guard(latch);
+    frames.clear();
+  }
+
+  //a frame leaves the list once it has no image left
+  void collect() {
+    std::lock_guard guard(latch);
+    if (frames.empty()) {
+      return;
+    }
+    Snapshot::Horizon horizon = Snapshot::horizon();
+    list<Frame *> kept;
+    for (Frame *frame: frames) {
+      if (frame->versions.collect(horizon)) {
+        kept.push_back(frame);
+      }
+    }
+    frames = kept;
+  }
+};
+
+#endif
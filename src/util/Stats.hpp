@@ -0,0 +1,105 @@
+#ifndef TICKETSYSTEM2024_STATS_HPP
+#define TICKETSYSTEM2024_STATS_HPP
+
+#include <string>
+#include <fstream>
+#include "../data_structure/list.hpp"
+
+//i/o counters. they are always on since each costs a single increment
+struct IoCounters {
+  unsigned long long reads = 0; //records read from file
+  unsigned long long writes = 0; //records written to file
+  unsigned long long hits = 0; //get served by cache
+  unsigned long long misses = 0; //get which has to read from file
+  unsigned long long seeks = 0; //accesses not continuing the previous one
+  unsigned long long bytesRead = 0;
+  unsigned long long bytesWritten = 0;
+
+  IoCounters &operator+=(const IoCounters &rhs) {
+    reads += rhs.reads;
+    writes += rhs.writes;
+    hits += rhs.hits;
+    misses += rhs.misses;
+    seeks += rhs.seeks;
+    bytesRead += rhs.bytesRead;
+    bytesWritten += rhs.bytesWritten;
+    return *this;
+  }
+
+  IoCounters operator-(const IoCounters &rhs) const {
+    IoCounters ret;
+    ret.reads = reads - rhs.reads;
+    ret.writes = writes - rhs.writes;
+    ret.hits = hits - rhs.hits;
+    ret.misses = misses - rhs.misses;
+    ret.seeks = seeks - rhs.seeks;
+    ret.bytesRead = bytesRead - rhs.bytesRead;
+    ret.bytesWritten = bytesWritten - rhs.bytesWritten;
+    return ret;
+  }
+
+  bool touchesFile() const {
+    return reads || writes;
+  }
+
+  std::string toString() const {
+    return std::to_string(reads) + ' ' + std::to_string(writes) + ' ' + std::to_string(hits) + ' ' +
+           std::to_string(misses) + ' ' + std::to_string(seeks) + ' ' + std::to_string(bytesRead) + ' ' +
+           std::to_string(bytesWritten);
+  }
+};
+
+//counters of a file store
+struct StorageStats : IoCounters {
+  std::string name;
+  unsigned long long corrupt = 0; //records read whose checksum did not match, on load or by scrub
+  IoCounters mark; //the counters when the command being counted began, see Stats::mark
+
+  void read(int bytes) {
+    reads++;
+    bytesRead += bytes;
+  }
+
+  void write(int bytes) {
+    writes++;
+    bytesWritten += bytes;
+  }
+};
+
+namespace Stats {
+  constexpr const char *COUNTER_NAMES = "reads writes hits misses seeks bytes_read bytes_written";
+
+  bool enabled = false; //whether commands are timed and their i/o is counted. see Commands::run
+  list<StorageStats *> stores; //registered by the stores themselves
+  //one line per command: timestamp, name, latency in us, then store:counters for each store the command touched,
+  //with the counters comma separated in the order of COUNTER_NAMES
+  std::ofstream trace;
+
+  void add(StorageStats *stats) {
+    stores.push_back(stats);
+  }
+
+  void remove(StorageStats *stats) {
+    for (size_t i = 0; i < stores.size(); i++) {
+      if (stores[i] == stats) {
+        stores[i] = stores.back();
+        stores.pop_back();
+        return;
+      }
+    }
+  }
+
+  //note the counters of every store, so that the i/o of a command is what they gained since. a store opened by the
+  //command starts from zero, and one closed by it takes its counters along
+  void mark() {
+    for (size_t i = 0; i < stores.size(); i++) {
+      stores[i]->mark = *stores[i];
+    }
+  }
+
+  bool tracing() {
+    return trace.is_open();
+  }
+}
+
+#endif
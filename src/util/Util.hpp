@@ -10,62 +10,74 @@
 #include <string>
 #include <cstring>
 #include <cmath>
+#include <bit>
+#include <compare>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "StringParser.hpp"
 #include "../data_structure/map.hpp"
 #include "../data_structure/priority_queue.hpp"
+#include "../data_structure/top_k.hpp"
 #include "../data_structure/list.hpp"
 #include "../data_structure/set.hpp"
 
+//the searches below are branchless: the range halves a fixed number of times and the comparison only picks which half,
+//so the compiler emits a conditional move instead of a hard to predict branch
 template<typename T>
 T *lower_bound(T *first, T *last, const T &val) {
-  while (first < last) {
-    T *mid = first + (last - first) / 2;
-    if (*mid < val) {
-      first = mid + 1;
-    } else {
-      last = mid;
-    }
+  size_t n = last - first;
+  if (n == 0) {
+    return first;
+  }
+  while (n > 1) {
+    size_t half = n / 2;
+    first = first[half] < val ? first + half : first;
+    n -= half;
   }
-  return first;
+  return first + (*first < val);
 }
 
 template<typename T>
 T *upper_bound(T *first, T *last, const T &val) {
-  while (first < last) {
-    T *mid = first + (last - first) / 2;
-    if (val >= *mid) {
-      first = mid + 1;
-    } else {
-      last = mid;
-    }
+  size_t n = last - first;
+  if (n == 0) {
+    return first;
+  }
+  while (n > 1) {
+    size_t half = n / 2;
+    first = val >= first[half] ? first + half : first;
+    n -= half;
   }
-  return first;
+  return first + (val >= *first);
 }
 
 template<typename T, typename INDEX>
 T *lower_index_bound(T *first, T *last, const INDEX &val) {
-  while (first < last) {
-    T *mid = first + (last - first) / 2;
-    if (mid->index() < val) {
-      first = mid + 1;
-    } else {
-      last = mid;
-    }
+  size_t n = last - first;
+  if (n == 0) {
+    return first;
   }
-  return first;
+  while (n > 1) {
+    size_t half = n / 2;
+    first = first[half].index() < val ? first + half : first;
+    n -= half;
+  }
+  return first + (first->index() < val);
 }
 
 template<typename T, typename INDEX>
 T *upper_index_bound(T *first, T *last, const INDEX &val) {
-  while (first < last) {
-    T *mid = first + (last - first) / 2;
-    if (val >= mid->index()) {
-      first = mid + 1;
-    } else {
-      last = mid;
-    }
+  size_t n = last - first;
+  if (n == 0) {
+    return first;
+  }
+  while (n > 1) {
+    size_t half = n / 2;
+    first = val >= first[half].index() ? first + half : first;
+    n -= half;
   }
-  return first;
+  return first + (val >= first->index());
 }
 
 struct Chrono {
@@ -124,15 +136,53 @@ public:
     }
     strncpy(key, s.c_str(), L);
   }
-  
+
   FixedString() = default;
-  
-  auto operator<=>(const FixedString &rhs) const = default;
+
+  //the same order as comparing the chars one by one, which the stored trees are sorted by, so names in UTF-8
+  //keep sorting before ASCII where char is signed. 16 bytes are checked at a time for the first difference
+  std::strong_ordering operator<=>(const FixedString &rhs) const {
+    int i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= L; i += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(key + i));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rhs.key + i));
+      unsigned int diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xffff;
+      if (diff) {
+        int j = i + __builtin_ctz(diff);
+        return key[j] <=> rhs.key[j];
+      }
+    }
+#endif
+    for (; i + 8 <= L; i += 8) {
+      unsigned long long a, b;
+      memcpy(&a, key + i, 8);
+      memcpy(&b, rhs.key + i, 8);
+      if (a != b) { //the lowest differing byte comes first in memory on little-endian machines
+        int j = i + (std::endian::native == std::endian::little ? __builtin_ctzll(a ^ b) : __builtin_clzll(a ^ b)) / 8;
+        return key[j] <=> rhs.key[j];
+      }
+    }
+    for (; i < L; i++) {
+      if (key[i] != rhs.key[i]) {
+        return key[i] <=> rhs.key[i];
+      }
+    }
+    return std::strong_ordering::equal;
+  }
+
+  bool operator==(const FixedString &rhs) const {
+    return memcmp(key, rhs.key, L) == 0;
+  }
 
   int len() const {
     return strnlen(key, L);
   }
 
+  const char *data() const {
+    return key;
+  }
+
   char *begin() const {
     return key;
   }